@@ -0,0 +1,290 @@
+#include "analysis.h"
+
+bool ir_arg_is_var(IrArg *arg, Str name) {
+  return arg->kind == IrArgKindVar && str_eq(arg->as.var, name);
+}
+
+bool ir_arg_get_const(IrArg *arg, i64 *value) {
+  if (arg->kind != IrArgKindValue)
+    return false;
+
+  IrArgValueAs *as = &arg->as.value.as;
+
+  switch (arg->as.value.type->kind) {
+  case TypeKindS64: *value = as->_s64; break;
+  case TypeKindS32: *value = as->_s32; break;
+  case TypeKindS16: *value = as->_s16; break;
+  case TypeKindS8:  *value = as->_s8; break;
+  case TypeKindU64: *value = (i64) as->_u64; break;
+  case TypeKindU32: *value = as->_u32; break;
+  case TypeKindU16: *value = as->_u16; break;
+  case TypeKindU8:  *value = as->_u8; break;
+  case TypeKindPtr: *value = (i64) as->_u64; break;
+  default:          return false;
+  }
+
+  return true;
+}
+
+Str *ir_instr_dest(IrInstr *instr) {
+  Str *dest = NULL;
+
+  switch (instr->kind) {
+  case IrInstrKindCreate:  dest = &instr->as.create.dest; break;
+  case IrInstrKindAssign:  dest = &instr->as.assign.dest; break;
+  case IrInstrKindCall:    dest = &instr->as.call.dest; break;
+  case IrInstrKindAsm:     dest = &instr->as._asm.dest; break;
+  case IrInstrKindBinOp:   dest = &instr->as.bin_op.dest; break;
+  case IrInstrKindUnOp:    dest = &instr->as.un_op.dest; break;
+  case IrInstrKindCast:    dest = &instr->as.cast.dest; break;
+  case IrInstrKindDeref:   dest = &instr->as.deref.dest; break;
+  default:                 return NULL;
+  }
+
+  if (dest->len == 0)
+    return NULL;
+
+  return dest;
+}
+
+bool ir_instr_defines_var(IrInstr *instr, Str name) {
+  Str *dest = ir_instr_dest(instr);
+  if (dest && str_eq(*dest, name))
+    return true;
+
+  // Inline assembly is free to write to any variable it was given
+  if (instr->kind == IrInstrKindAsm) {
+    VarNames *var_names = &instr->as._asm.var_names;
+    for (u32 i = 0; i < var_names->len; ++i)
+      if (str_eq(var_names->items[i], name))
+        return true;
+  }
+
+  return false;
+}
+
+bool ir_instr_uses_var(IrInstr *instr, Str name) {
+  switch (instr->kind) {
+  case IrInstrKindAssign: {
+    return ir_arg_is_var(&instr->as.assign.arg, name);
+  }
+
+  case IrInstrKindIf: {
+    return ir_arg_is_var(&instr->as._if.arg0, name) ||
+           ir_arg_is_var(&instr->as._if.arg1, name);
+  }
+
+  case IrInstrKindWhile: {
+    return ir_arg_is_var(&instr->as._while.arg0, name) ||
+           ir_arg_is_var(&instr->as._while.arg1, name);
+  }
+
+  case IrInstrKindRetVal: {
+    return ir_arg_is_var(&instr->as.ret_val.arg, name);
+  }
+
+  case IrInstrKindCall: {
+    IrArgs *args = &instr->as.call.args;
+    for (u32 i = 0; i < args->len; ++i)
+      if (ir_arg_is_var(args->items + i, name))
+        return true;
+    return false;
+  }
+
+  case IrInstrKindAsm: {
+    VarNames *var_names = &instr->as._asm.var_names;
+    for (u32 i = 0; i < var_names->len; ++i)
+      if (str_eq(var_names->items[i], name))
+        return true;
+    return false;
+  }
+
+  case IrInstrKindBinOp: {
+    return ir_arg_is_var(&instr->as.bin_op.arg0, name) ||
+           ir_arg_is_var(&instr->as.bin_op.arg1, name);
+  }
+
+  case IrInstrKindUnOp: {
+    return ir_arg_is_var(&instr->as.un_op.arg, name);
+  }
+
+  case IrInstrKindPreAssignOp: {
+    return str_eq(instr->as.pre_assign_op.dest, name) ||
+           ir_arg_is_var(&instr->as.pre_assign_op.arg, name) ||
+           (instr->as.pre_assign_op.is_indexed &&
+            ir_arg_is_var(&instr->as.pre_assign_op.index, name));
+  }
+
+  case IrInstrKindCast: {
+    return ir_arg_is_var(&instr->as.cast.arg, name);
+  }
+
+  case IrInstrKindDeref: {
+    return ir_arg_is_var(&instr->as.deref.arg, name) ||
+           (instr->as.deref.is_indexed &&
+            ir_arg_is_var(&instr->as.deref.index, name));
+  }
+
+  default: return false;
+  }
+}
+
+bool ir_instr_refers_var(IrInstr *instr, Str name) {
+  return ir_instr_defines_var(instr, name) ||
+         ir_instr_uses_var(instr, name);
+}
+
+bool ir_instr_may_write_memory(IrInstr *instr) {
+  return instr->kind == IrInstrKindCall ||
+         instr->kind == IrInstrKindAsm ||
+         instr->kind == IrInstrKindPreAssignOp;
+}
+
+bool ir_instr_is_control_flow(IrInstr *instr) {
+  return instr->kind == IrInstrKindIf ||
+         instr->kind == IrInstrKindWhile ||
+         instr->kind == IrInstrKindJump ||
+         instr->kind == IrInstrKindLabel ||
+         instr->kind == IrInstrKindRet ||
+         instr->kind == IrInstrKindRetVal;
+}
+
+static void ir_arg_replace_var(IrArg *arg, Str name, IrArg *new_arg) {
+  if (ir_arg_is_var(arg, name))
+    *arg = *new_arg;
+}
+
+static void ir_instr_replace_var_args(IrInstr *instr, Str name, IrArg *new_arg) {
+  switch (instr->kind) {
+  case IrInstrKindAssign: {
+    ir_arg_replace_var(&instr->as.assign.arg, name, new_arg);
+  } break;
+
+  case IrInstrKindIf: {
+    ir_arg_replace_var(&instr->as._if.arg0, name, new_arg);
+    ir_arg_replace_var(&instr->as._if.arg1, name, new_arg);
+  } break;
+
+  case IrInstrKindWhile: {
+    ir_arg_replace_var(&instr->as._while.arg0, name, new_arg);
+    ir_arg_replace_var(&instr->as._while.arg1, name, new_arg);
+  } break;
+
+  case IrInstrKindRetVal: {
+    ir_arg_replace_var(&instr->as.ret_val.arg, name, new_arg);
+  } break;
+
+  // Argument lists may be shared between copies of an instruction,
+  // so they are rebuilt instead of being modified in place
+  case IrInstrKindCall: {
+    IrArgs new_args = {0};
+    for (u32 i = 0; i < instr->as.call.args.len; ++i) {
+      IrArg arg = instr->as.call.args.items[i];
+      ir_arg_replace_var(&arg, name, new_arg);
+      DA_APPEND(new_args, arg);
+    }
+    instr->as.call.args = new_args;
+  } break;
+
+  case IrInstrKindBinOp: {
+    ir_arg_replace_var(&instr->as.bin_op.arg0, name, new_arg);
+    ir_arg_replace_var(&instr->as.bin_op.arg1, name, new_arg);
+  } break;
+
+  case IrInstrKindUnOp: {
+    ir_arg_replace_var(&instr->as.un_op.arg, name, new_arg);
+  } break;
+
+  case IrInstrKindPreAssignOp: {
+    ir_arg_replace_var(&instr->as.pre_assign_op.arg, name, new_arg);
+    if (instr->as.pre_assign_op.is_indexed)
+      ir_arg_replace_var(&instr->as.pre_assign_op.index, name, new_arg);
+  } break;
+
+  case IrInstrKindCast: {
+    ir_arg_replace_var(&instr->as.cast.arg, name, new_arg);
+  } break;
+
+  case IrInstrKindDeref: {
+    ir_arg_replace_var(&instr->as.deref.arg, name, new_arg);
+    if (instr->as.deref.is_indexed)
+      ir_arg_replace_var(&instr->as.deref.index, name, new_arg);
+  } break;
+
+  default: {}
+  }
+}
+
+void ir_instr_replace_var(IrInstr *instr, Str name, IrArg arg) {
+  ir_instr_replace_var_args(instr, name, &arg);
+}
+
+void ir_instr_rename_var(IrInstr *instr, Str from, Str to) {
+  Str *dest = ir_instr_dest(instr);
+  if (dest && str_eq(*dest, from))
+    *dest = to;
+
+  IrArg to_arg = { IrArgKindVar, { .var = to } };
+  ir_instr_replace_var_args(instr, from, &to_arg);
+
+  if (instr->kind == IrInstrKindAsm) {
+    VarNames new_var_names = {0};
+    for (u32 i = 0; i < instr->as._asm.var_names.len; ++i) {
+      Str var_name = instr->as._asm.var_names.items[i];
+      if (str_eq(var_name, from))
+        var_name = to;
+      DA_APPEND(new_var_names, var_name);
+    }
+    instr->as._asm.var_names = new_var_names;
+  } else if (instr->kind == IrInstrKindPreAssignOp &&
+             str_eq(instr->as.pre_assign_op.dest, from)) {
+    instr->as.pre_assign_op.dest = to;
+  }
+}
+
+bool ir_proc_var_is_address_taken(IrProc *proc, Str name) {
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+
+    if (instr->kind == IrInstrKindUnOp &&
+        str_eq(instr->as.un_op.op, STR_LIT("&")) &&
+        ir_arg_is_var(&instr->as.un_op.arg, name))
+      return true;
+  }
+
+  return false;
+}
+
+bool ir_is_static_var(Ir *ir, Str name) {
+  for (u32 i = 0; i < ir->static_vars.len; ++i)
+    if (str_eq(ir->static_vars.items[i].name, name))
+      return true;
+
+  for (u32 i = 0; i < ir->static_data.len; ++i)
+    if (str_eq(ir->static_data.items[i].name, name))
+      return true;
+
+  return false;
+}
+
+IrProc *ir_find_proc(Ir *ir, Str name, u32 params_count) {
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+
+    if (str_eq(proc->name, name) && proc->params.len == params_count)
+      return proc;
+  }
+
+  return NULL;
+}
+
+u32 ir_instrs_find_label(IrInstrs *instrs, Str name, u32 begin) {
+  for (u32 i = begin; i < instrs->len; ++i) {
+    IrInstr *instr = instrs->items + i;
+
+    if (instr->kind == IrInstrKindLabel && str_eq(instr->as.label.name, name))
+      return i;
+  }
+
+  return instrs->len;
+}
@@ -0,0 +1,21 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "ir.h"
+
+bool    ir_arg_is_var(IrArg *arg, Str name);
+bool    ir_arg_get_const(IrArg *arg, i64 *value);
+Str    *ir_instr_dest(IrInstr *instr);
+bool    ir_instr_defines_var(IrInstr *instr, Str name);
+bool    ir_instr_uses_var(IrInstr *instr, Str name);
+bool    ir_instr_refers_var(IrInstr *instr, Str name);
+bool    ir_instr_may_write_memory(IrInstr *instr);
+bool    ir_instr_is_control_flow(IrInstr *instr);
+void    ir_instr_rename_var(IrInstr *instr, Str from, Str to);
+void    ir_instr_replace_var(IrInstr *instr, Str name, IrArg arg);
+bool    ir_proc_var_is_address_taken(IrProc *proc, Str name);
+bool    ir_is_static_var(Ir *ir, Str name);
+IrProc *ir_find_proc(Ir *ir, Str name, u32 params_count);
+u32     ir_instrs_find_label(IrInstrs *instrs, Str name, u32 begin);
+
+#endif // ANALYSIS_H
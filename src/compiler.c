@@ -3,6 +3,8 @@
 #include "ir_to_mvm.h"
 #include "shl/shl-log.h"
 
+#define LOOP_HEAD_ALIGNMENT 16
+
 typedef struct {
   Program  program;
   Ir      *ir;
@@ -34,6 +36,64 @@ Str type_kinds_ptr_prefixes_table[TypeKindsCount] = {
   [TypeKindPtr] = STR_LIT("qword"),
 };
 
+u32 type_kinds_sizes_table[TypeKindsCount] = {
+  [TypeKindUnit] = 0,
+  [TypeKindS64] = 8,
+  [TypeKindS32] = 4,
+  [TypeKindS16] = 2,
+  [TypeKindS8] = 1,
+  [TypeKindU64] = 8,
+  [TypeKindU32] = 4,
+  [TypeKindU16] = 2,
+  [TypeKindU8] = 1,
+  [TypeKindPtr] = 8,
+};
+
+static RelOp rel_op_negate(RelOp rel_op) {
+  switch (rel_op) {
+  case RelOpEqual:          return RelOpNotEqual;
+  case RelOpNotEqual:       return RelOpEqual;
+  case RelOpLess:           return RelOpGreaterOrEqual;
+  case RelOpGreater:        return RelOpLessOrEqual;
+  case RelOpLessOrEqual:    return RelOpGreater;
+  case RelOpGreaterOrEqual: return RelOpLess;
+  default:                  return rel_op;
+  }
+}
+
+// Returns the loop that is closed by the jump if it is a back edge
+static IrInstrWhile *ir_proc_find_back_edge_loop(IrProc *ir_proc, u32 jump_index) {
+  if (jump_index + 1 >= ir_proc->instrs.len)
+    return NULL;
+
+  IrInstr *jump = ir_proc->instrs.items + jump_index;
+  IrInstr *next = ir_proc->instrs.items + jump_index + 1;
+  if (next->kind != IrInstrKindLabel)
+    return NULL;
+
+  for (u32 i = jump_index; i > 0; --i) {
+    IrInstr *instr = ir_proc->instrs.items + i - 1;
+
+    if (instr->kind == IrInstrKindWhile &&
+        str_eq(instr->as._while.begin_label_name, jump->as.jump.label_name) &&
+        str_eq(instr->as._while.end_label_name, next->as.label.name))
+      return &instr->as._while;
+  }
+
+  return NULL;
+}
+
+static void proc_align(Procedure *proc, u32 alignment) {
+  InlineAsmSegments segments = {0};
+
+  StringBuilder sb = {0};
+  sb_push(&sb, "align ");
+  sb_push_u32(&sb, alignment);
+  segments_push_text(&segments, sb_to_str(sb));
+
+  proc_inline_asm(proc, (Str) {0}, ValueKindUnit, segments);
+}
+
 static void compile_ir_instrs(Compiler *compiler, Procedure *proc, u32 ir_proc_index) {
   IrProc *ir_proc = compiler->ir->procs.items + ir_proc_index;
   for (u32 i = 0; i < ir_proc->instrs.len; ++i) {
@@ -63,17 +123,32 @@ static void compile_ir_instrs(Compiler *compiler, Procedure *proc, u32 ir_proc_i
       RelOp rel_op = ir_instr->as._while.rel_op;
       Arg arg0 = ir_arg_to_arg(&ir_instr->as._while.arg0);
       Arg arg1 = ir_arg_to_arg(&ir_instr->as._while.arg1);
-      Str begin_label_name = ir_instr->as._while.begin_label_name;
       Str end_label_name = ir_instr->as._while.end_label_name;
+      Str body_label_name = ir_instr->as._while.body_label_name;
 
-      proc_add_label(proc, begin_label_name);
+      // Loops are rotated: the condition is checked once before the loop
+      // is entered and then at the bottom of every iteration, so only one
+      // branch is executed per iteration
       proc_cond_jump(proc, rel_op, arg0, arg1, end_label_name);
+      proc_align(proc, LOOP_HEAD_ALIGNMENT);
+      proc_add_label(proc, body_label_name);
     } break;
 
     case IrInstrKindJump: {
       Str label_name = ir_instr->as.jump.label_name;
-
-      proc_jump(proc, label_name);
+      IrInstrWhile *_while = ir_proc_find_back_edge_loop(ir_proc, i);
+
+      if (_while) {
+        RelOp rel_op = rel_op_negate(_while->rel_op);
+        Arg arg0 = ir_arg_to_arg(&_while->arg0);
+        Arg arg1 = ir_arg_to_arg(&_while->arg1);
+
+        // `continue` jumps here too
+        proc_add_label(proc, _while->begin_label_name);
+        proc_cond_jump(proc, rel_op, arg0, arg1, _while->body_label_name);
+      } else {
+        proc_jump(proc, label_name);
+      }
     } break;
 
     case IrInstrKindLabel: {
@@ -203,7 +278,11 @@ static void compile_ir_instrs(Compiler *compiler, Procedure *proc, u32 ir_proc_i
 
       proc_compile_pre_assign_intrinsic(proc, instr_pre_assign_op->dest,
                                         instr_pre_assign_op->op,
-                                        instr_pre_assign_op->arg);
+                                        instr_pre_assign_op->arg,
+                                        instr_pre_assign_op->type,
+                                        instr_pre_assign_op->is_indexed ?
+                                          &instr_pre_assign_op->index : NULL,
+                                        instr_pre_assign_op->offset);
     } break;
 
     case IrInstrKindCast: {
@@ -219,7 +298,9 @@ static void compile_ir_instrs(Compiler *compiler, Procedure *proc, u32 ir_proc_i
 
       proc_compile_deref_intrinsic(proc, instr_deref->dest,
                                    instr_deref->type,
-                                   instr_deref->arg);
+                                   instr_deref->arg,
+                                   instr_deref->is_indexed ? &instr_deref->index : NULL,
+                                   instr_deref->offset);
     } break;
 
     default: {
@@ -236,7 +317,8 @@ Program compile_ir(Ir *ir) {
 
   for (u32 i = 0; i < ir->static_vars.len; ++i) {
     StaticVariable *var = ir->static_vars.items + i;
-    program_push_static_var(&compiler.program, var->name, var->value);
+    program_push_static_var(&compiler.program, var->name,
+                            ir_arg_value_to_value(&var->value));
   }
 
   for (u32 i = 0; i < ir->static_data.len; ++i) {
@@ -0,0 +1,299 @@
+#include <stdlib.h>
+
+#include "interpreter.h"
+#include "analysis.h"
+#include "intrinsic.h"
+
+#define INTERPRETER_MAX_STEPS      100000
+#define INTERPRETER_MAX_CALL_DEPTH 64
+
+typedef struct {
+  Str name;
+  i64 value;
+} InterpreterVar;
+
+typedef Da(InterpreterVar) InterpreterVars;
+
+typedef struct {
+  Ir  *ir;
+  u32  steps_count;
+  u32  call_depth;
+} Interpreter;
+
+static bool interpreter_call(Interpreter *interpreter, IrProc *proc,
+                             i64 *args, i64 *result);
+
+bool ir_type_is_signed_int(Type *type) {
+  return type->kind == TypeKindS64 ||
+         type->kind == TypeKindS32 ||
+         type->kind == TypeKindS16 ||
+         type->kind == TypeKindS8;
+}
+
+static i64 truncate_to_type(Type *type, i64 value) {
+  switch (type->kind) {
+  case TypeKindS32: return (i32) value;
+  case TypeKindS16: return (i16) value;
+  case TypeKindS8:  return (i8) value;
+  default:          return value;
+  }
+}
+
+IrArgValue ir_arg_value_new(Type *type, i64 value) {
+  switch (type->kind) {
+  case TypeKindS32: return (IrArgValue) { type, { ._s32 = value } };
+  case TypeKindS16: return (IrArgValue) { type, { ._s16 = value } };
+  case TypeKindS8:  return (IrArgValue) { type, { ._s8 = value } };
+  case TypeKindU64: return (IrArgValue) { type, { ._u64 = value } };
+  case TypeKindU32: return (IrArgValue) { type, { ._u32 = value } };
+  case TypeKindU16: return (IrArgValue) { type, { ._u16 = value } };
+  case TypeKindU8:  return (IrArgValue) { type, { ._u8 = value } };
+  case TypeKindPtr: return (IrArgValue) { type, { ._u64 = value } };
+  default:          return (IrArgValue) { type, { ._s64 = value } };
+  }
+}
+
+static InterpreterVar *vars_find(InterpreterVars *vars, Str name) {
+  for (u32 i = 0; i < vars->len; ++i)
+    if (str_eq(vars->items[i].name, name))
+      return vars->items + i;
+
+  return NULL;
+}
+
+// Writing a global is a side effect that can not be folded
+static bool vars_set(Interpreter *interpreter, InterpreterVars *vars,
+                     Str name, i64 value) {
+  if (ir_is_static_var(interpreter->ir, name))
+    return false;
+
+  InterpreterVar *var = vars_find(vars, name);
+
+  if (var) {
+    var->value = value;
+  } else {
+    InterpreterVar new_var = { name, value };
+    DA_APPEND(*vars, new_var);
+  }
+
+  return true;
+}
+
+// Only signed integers are supported, since comparisons would have to
+// know the signedness of every variable otherwise
+static bool eval_arg(InterpreterVars *vars, IrArg *arg, i64 *value) {
+  if (arg->kind == IrArgKindValue)
+    return ir_type_is_signed_int(arg->as.value.type) &&
+           ir_arg_get_const(arg, value);
+
+  InterpreterVar *var = vars_find(vars, arg->as.var);
+  if (!var)
+    return false;
+
+  *value = var->value;
+  return true;
+}
+
+bool ir_eval_rel_op(RelOp rel_op, i64 lhs, i64 rhs) {
+  switch (rel_op) {
+  case RelOpEqual:          return lhs == rhs;
+  case RelOpNotEqual:       return lhs != rhs;
+  case RelOpLess:           return lhs < rhs;
+  case RelOpGreater:        return lhs > rhs;
+  case RelOpLessOrEqual:    return lhs <= rhs;
+  case RelOpGreaterOrEqual: return lhs >= rhs;
+  default:                  return false;
+  }
+}
+
+// Loops have no label at their beginning, so jumping there means
+// jumping to the `while` itself
+static u32 find_jump_target(IrInstrs *instrs, Str label_name) {
+  u32 index = ir_instrs_find_label(instrs, label_name, 0);
+  if (index < instrs->len)
+    return index;
+
+  for (u32 i = 0; i < instrs->len; ++i) {
+    IrInstr *instr = instrs->items + i;
+
+    if (instr->kind == IrInstrKindWhile &&
+        str_eq(instr->as._while.begin_label_name, label_name))
+      return i;
+  }
+
+  return instrs->len;
+}
+
+static bool interpreter_exec(Interpreter *interpreter, IrProc *proc,
+                             InterpreterVars *vars, i64 *result) {
+  IrInstrs *instrs = &proc->instrs;
+  u32 i = 0;
+
+  while (i < instrs->len) {
+    if (++interpreter->steps_count > INTERPRETER_MAX_STEPS)
+      return false;
+
+    IrInstr *instr = instrs->items + i;
+    ++i;
+
+    switch (instr->kind) {
+    case IrInstrKindAssign: {
+      i64 value;
+      if (!eval_arg(vars, &instr->as.assign.arg, &value))
+        return false;
+      if (!vars_set(interpreter, vars, instr->as.assign.dest, value))
+        return false;
+    } break;
+
+    case IrInstrKindIf: {
+      IrInstrIf *_if = &instr->as._if;
+      i64 lhs, rhs;
+      if (!eval_arg(vars, &_if->arg0, &lhs) ||
+          !eval_arg(vars, &_if->arg1, &rhs))
+        return false;
+
+      if (ir_eval_rel_op(_if->rel_op, lhs, rhs)) {
+        i = ir_instrs_find_label(instrs, _if->label_name, 0);
+        if (i >= instrs->len)
+          return false;
+      }
+    } break;
+
+    case IrInstrKindWhile: {
+      IrInstrWhile *_while = &instr->as._while;
+      i64 lhs, rhs;
+      if (!eval_arg(vars, &_while->arg0, &lhs) ||
+          !eval_arg(vars, &_while->arg1, &rhs))
+        return false;
+
+      if (ir_eval_rel_op(_while->rel_op, lhs, rhs)) {
+        i = ir_instrs_find_label(instrs, _while->end_label_name, 0);
+        if (i >= instrs->len)
+          return false;
+      }
+    } break;
+
+    case IrInstrKindJump: {
+      i = find_jump_target(instrs, instr->as.jump.label_name);
+      if (i >= instrs->len)
+        return false;
+    } break;
+
+    case IrInstrKindLabel: {} break;
+
+    case IrInstrKindRet: {
+      *result = 0;
+      return true;
+    }
+
+    case IrInstrKindRetVal: {
+      if (!eval_arg(vars, &instr->as.ret_val.arg, result))
+        return false;
+      *result = truncate_to_type(proc->ret_val_type, *result);
+      return true;
+    }
+
+    case IrInstrKindCall: {
+      IrInstrCall *call = &instr->as.call;
+      IrProc *callee = ir_find_proc(interpreter->ir, call->callee_name,
+                                    call->args.len);
+      if (!callee)
+        return false;
+
+      i64 *args = malloc(call->args.len * sizeof(i64));
+      bool is_ok = true;
+      for (u32 j = 0; j < call->args.len && is_ok; ++j)
+        is_ok = eval_arg(vars, call->args.items + j, args + j);
+
+      i64 value = 0;
+      if (is_ok)
+        is_ok = interpreter_call(interpreter, callee, args, &value);
+
+      free(args);
+
+      if (!is_ok)
+        return false;
+
+      if (call->dest.len > 0 && !vars_set(interpreter, vars, call->dest, value))
+        return false;
+    } break;
+
+    case IrInstrKindBinOp: {
+      IrInstrBinOp *bin_op = &instr->as.bin_op;
+      i64 lhs, rhs, value;
+      if (!eval_arg(vars, &bin_op->arg0, &lhs) ||
+          !eval_arg(vars, &bin_op->arg1, &rhs) ||
+          !fold_bin_op(bin_op->op, lhs, rhs, &value))
+        return false;
+      if (!vars_set(interpreter, vars, bin_op->dest, value))
+        return false;
+    } break;
+
+    case IrInstrKindUnOp: {
+      IrInstrUnOp *un_op = &instr->as.un_op;
+      i64 value;
+      if (!str_eq(un_op->op, STR_LIT("-")) ||
+          !eval_arg(vars, &un_op->arg, &value))
+        return false;
+      if (!vars_set(interpreter, vars, un_op->dest, -(u64) value))
+        return false;
+    } break;
+
+    case IrInstrKindCast: {
+      IrInstrCast *cast = &instr->as.cast;
+      i64 value;
+      if (!ir_type_is_signed_int(cast->type) ||
+          !eval_arg(vars, &cast->arg, &value))
+        return false;
+      if (!vars_set(interpreter, vars, cast->dest,
+                    truncate_to_type(cast->type, value)))
+        return false;
+    } break;
+
+    // Memory, records and inline assembly are not modeled
+    default: return false;
+    }
+  }
+
+  *result = 0;
+  return true;
+}
+
+static bool interpreter_call(Interpreter *interpreter, IrProc *proc,
+                             i64 *args, i64 *result) {
+  if (proc->is_naked ||
+      interpreter->call_depth >= INTERPRETER_MAX_CALL_DEPTH)
+    return false;
+
+  InterpreterVars vars = {0};
+
+  for (u32 i = 0; i < proc->params.len; ++i) {
+    IrProcParam *param = proc->params.items + i;
+
+    if (!ir_type_is_signed_int(param->type)) {
+      free(vars.items);
+      return false;
+    }
+
+    InterpreterVar var = { param->name, truncate_to_type(param->type, args[i]) };
+    DA_APPEND(vars, var);
+  }
+
+  ++interpreter->call_depth;
+  bool is_ok = interpreter_exec(interpreter, proc, &vars, result);
+  --interpreter->call_depth;
+
+  free(vars.items);
+
+  return is_ok;
+}
+
+bool ir_eval_call(Ir *ir, IrProc *proc, i64 *args, i64 *result) {
+  if (!ir_type_is_signed_int(proc->ret_val_type))
+    return false;
+
+  Interpreter interpreter = {0};
+  interpreter.ir = ir;
+
+  return interpreter_call(&interpreter, proc, args, result);
+}
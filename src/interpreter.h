@@ -0,0 +1,14 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "ir.h"
+
+// Evaluates a call to `proc` with constant arguments. Returns false if
+// the procedure can not be evaluated at compile time: it touches memory,
+// uses inline assembly, reads a global or does not finish in time
+bool ir_eval_call(Ir *ir, IrProc *proc, i64 *args, i64 *result);
+bool ir_eval_rel_op(RelOp rel_op, i64 lhs, i64 rhs);
+bool ir_type_is_signed_int(Type *type);
+IrArgValue ir_arg_value_new(Type *type, i64 value);
+
+#endif // INTERPRETER_H
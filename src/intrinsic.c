@@ -1,6 +1,9 @@
+#include <stdint.h>
+
 #include "intrinsic.h"
 #include "mvm/src/misc.h"
 #include "ir_to_mvm.h"
+#include "analysis.h"
 #include "shl/shl-log.h"
 
 static void segments_push_ir_arg(InlineAsmSegments *segments, IrArg *arg,
@@ -13,48 +16,486 @@ static void segments_push_ir_arg(InlineAsmSegments *segments, IrArg *arg,
   }
 }
 
-void proc_compile_bin_intrinsic(Procedure *proc, Str dest, Str op, IrArg arg0, IrArg arg1) {
+static Value value_new_s64(i64 value) {
+  return (Value) { ValueKindS64, { .s64 = value } };
+}
+
+static void segments_push_i64(InlineAsmSegments *segments, i64 value) {
+  segments_push_text(segments, value_to_str(value_new_s64(value)));
+}
+
+static bool fits_imm32(i64 value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool is_power_of_two(u64 value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+static u32 log2_u64(u64 value) {
+  u32 result = 0;
+  while (value >>= 1)
+    ++result;
+  return result;
+}
+
+bool fold_bin_op(Str op, i64 lhs, i64 rhs, i64 *result) {
+  if (str_eq(op, STR_LIT("+")))
+    *result = (u64) lhs + (u64) rhs;
+  else if (str_eq(op, STR_LIT("-")))
+    *result = (u64) lhs - (u64) rhs;
+  else if (str_eq(op, STR_LIT("*")))
+    *result = (u64) lhs * (u64) rhs;
+  else if (str_eq(op, STR_LIT("&")))
+    *result = lhs & rhs;
+  else if (str_eq(op, STR_LIT("|")))
+    *result = lhs | rhs;
+  else if (str_eq(op, STR_LIT("^")))
+    *result = lhs ^ rhs;
+  else if (str_eq(op, STR_LIT("<<")))
+    *result = (u64) lhs << (rhs & 63);
+  else if (str_eq(op, STR_LIT(">>")))
+    *result = lhs >> (rhs & 63);
+  else if (rhs == 0 || (lhs == INT64_MIN && rhs == -1))
+    return false;
+  else if (str_eq(op, STR_LIT("/")))
+    *result = lhs / rhs;
+  else if (str_eq(op, STR_LIT("%")))
+    *result = lhs % rhs;
+  else
+    return false;
+
+  return true;
+}
+
+// Hacker's Delight, 10-1: magic number and shift for signed division
+// by a constant that is not 0, 1, -1 or a power of two
+static void signed_div_magic(i64 divisor, i64 *magic, u32 *shift) {
+  u64 two63 = (u64) 1 << 63;
+  u64 abs_d = divisor < 0 ? -(u64) divisor : (u64) divisor;
+  u64 t = two63 + ((u64) divisor >> 63);
+  u64 abs_nc = t - 1 - t % abs_d;
+  u32 p = 63;
+  u64 q1 = two63 / abs_nc;
+  u64 r1 = two63 - q1 * abs_nc;
+  u64 q2 = two63 / abs_d;
+  u64 r2 = two63 - q2 * abs_d;
+  u64 delta;
+
+  do {
+    ++p;
+
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= abs_nc) {
+      ++q1;
+      r1 -= abs_nc;
+    }
+
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= abs_d) {
+      ++q2;
+      r2 -= abs_d;
+    }
+
+    delta = abs_d - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  *magic = divisor < 0 ? -(i64) (q2 + 1) : (i64) (q2 + 1);
+  *shift = p - 64;
+}
+
+static void proc_compile_mul_by_const(Procedure *proc, Str dest, IrArg arg, i64 factor) {
   InlineAsmSegments segments = {0};
+  u64 abs_factor = factor < 0 ? -(u64) factor : (u64) factor;
 
-  proc_assign(proc, dest, ir_arg_to_arg(&arg0));
+  if (factor == 0 || factor == 1) {
+    Arg zero = { ArgKindValue, { .value = value_new_s64(0) } };
+    proc_assign(proc, dest, factor == 0 ? zero : ir_arg_to_arg(&arg));
+    return;
+  }
 
-  if (str_eq(op, STR_LIT("+")) || str_eq(op, STR_LIT("-"))) {
-    if (str_eq(op, STR_LIT("+")))
-      segments_push_text(&segments, STR_LIT("add "));
-    else
-      segments_push_text(&segments, STR_LIT("sub "));
+  if (factor == 3 || factor == 5 || factor == 9) {
+    segments_push_text(&segments, STR_LIT("lea "));
+    segments_push_var(&segments, dest, TargetLocKindReg, true);
+    segments_push_text(&segments, STR_LIT(",["));
+    segments_push_ir_arg(&segments, &arg, TargetLocKindReg, false);
+    segments_push_text(&segments, STR_LIT("+"));
+    segments_push_ir_arg(&segments, &arg, TargetLocKindReg, false);
+    segments_push_text(&segments, STR_LIT("*"));
+    segments_push_i64(&segments, factor - 1);
+    segments_push_text(&segments, STR_LIT("]"));
+  } else if (is_power_of_two(abs_factor)) {
+    if (!ir_arg_is_var(&arg, dest))
+      proc_assign(proc, dest, ir_arg_to_arg(&arg));
+
+    segments_push_text(&segments, STR_LIT("shl "));
     segments_push_var(&segments, dest, TargetLocKindNotImm, true);
     segments_push_text(&segments, STR_LIT(","));
-    segments_push_ir_arg(&segments, &arg1, TargetLocKindImm, false);
-  } else if (str_eq(op, STR_LIT("*")) || str_eq(op, STR_LIT("/")) || str_eq(op, STR_LIT("%"))) {
+    segments_push_i64(&segments, log2_u64(abs_factor));
+
+    if (factor < 0) {
+      segments_push_text(&segments, STR_LIT("\n  neg "));
+      segments_push_var(&segments, dest, TargetLocKindNotImm, true);
+    }
+  } else if (fits_imm32(factor)) {
+    segments_push_text(&segments, STR_LIT("imul "));
+    segments_push_var(&segments, dest, TargetLocKindReg, true);
+    segments_push_text(&segments, STR_LIT(","));
+    segments_push_ir_arg(&segments, &arg, TargetLocKindNotImm, false);
+    segments_push_text(&segments, STR_LIT(","));
+    segments_push_i64(&segments, factor);
+  } else {
+    segments_push_text(&segments, STR_LIT("mov rax,"));
+    segments_push_i64(&segments, factor);
+    segments_push_text(&segments, STR_LIT("\n  imul "));
+    segments_push_ir_arg(&segments, &arg, TargetLocKindNotImm, false);
+    segments_push_text(&segments, STR_LIT("\n  mov "));
+    segments_push_var(&segments, dest, TargetLocKindAny, true);
+    segments_push_text(&segments, STR_LIT(",rax"));
+  }
+
+  proc_inline_asm(proc, dest, ValueKindS64, segments);
+}
+
+// Quotient and remainder are rounded towards zero, like `idiv` does
+static void proc_compile_div_by_const(Procedure *proc, Str dest, Str op,
+                                      IrArg arg, i64 divisor) {
+  InlineAsmSegments segments = {0};
+  bool is_rem = str_eq(op, STR_LIT("%"));
+  u64 abs_divisor = divisor < 0 ? -(u64) divisor : (u64) divisor;
+
+  // The division may be unreachable, so it is not rejected. `rdx` is
+  // zero, which makes `idiv` raise the same fault as at run time
+  if (divisor == 0) {
+    segments_push_text(&segments, STR_LIT("mov rax,"));
+    segments_push_ir_arg(&segments, &arg, TargetLocKindImm, false);
+    segments_push_text(&segments, STR_LIT("\n  xor edx,edx\n  idiv rdx\n  mov "));
+    segments_push_var(&segments, dest, TargetLocKindAny, true);
+    segments_push_text(&segments, STR_LIT(",rax"));
+    proc_inline_asm(proc, dest, ValueKindS64, segments);
+    return;
+  }
+
+  if (divisor == 1 || divisor == -1) {
+    if (is_rem) {
+      Arg zero = { ArgKindValue, { .value = value_new_s64(0) } };
+      proc_assign(proc, dest, zero);
+      return;
+    }
+
+    proc_assign(proc, dest, ir_arg_to_arg(&arg));
+    if (divisor == 1)
+      return;
+
+    segments_push_text(&segments, STR_LIT("neg "));
+    segments_push_var(&segments, dest, TargetLocKindNotImm, true);
+    proc_inline_asm(proc, dest, ValueKindS64, segments);
+    return;
+  }
+
+  segments_push_text(&segments, STR_LIT("mov rax,"));
+  segments_push_ir_arg(&segments, &arg, TargetLocKindImm, false);
+
+  if (is_power_of_two(abs_divisor)) {
+    u32 shift = log2_u64(abs_divisor);
+
+    // Negative dividends are biased by `divisor - 1` to round towards zero
+    segments_push_text(&segments, STR_LIT("\n  cqo\n  shr rdx,"));
+    segments_push_i64(&segments, 64 - shift);
+
+    if (is_rem) {
+      segments_push_text(&segments, STR_LIT("\n  add rdx,rax\n  sar rdx,"));
+      segments_push_i64(&segments, shift);
+      segments_push_text(&segments, STR_LIT("\n  shl rdx,"));
+      segments_push_i64(&segments, shift);
+      segments_push_text(&segments, STR_LIT("\n  sub rax,rdx"));
+    } else {
+      segments_push_text(&segments, STR_LIT("\n  add rax,rdx\n  sar rax,"));
+      segments_push_i64(&segments, shift);
+      if (divisor < 0)
+        segments_push_text(&segments, STR_LIT("\n  neg rax"));
+    }
+
+    segments_push_text(&segments, STR_LIT("\n  mov "));
+    segments_push_var(&segments, dest, TargetLocKindAny, true);
+    segments_push_text(&segments, STR_LIT(",rax"));
+  } else {
+    i64 magic;
+    u32 shift;
+    signed_div_magic(divisor, &magic, &shift);
+
+    segments_push_text(&segments, STR_LIT("\n  mov rdx,"));
+    segments_push_i64(&segments, magic);
+    segments_push_text(&segments, STR_LIT("\n  imul rdx"));
+
+    if (divisor > 0 && magic < 0) {
+      segments_push_text(&segments, STR_LIT("\n  add rdx,"));
+      segments_push_ir_arg(&segments, &arg, TargetLocKindImm, false);
+    } else if (divisor < 0 && magic > 0) {
+      segments_push_text(&segments, STR_LIT("\n  sub rdx,"));
+      segments_push_ir_arg(&segments, &arg, TargetLocKindImm, false);
+    }
+
+    if (shift > 0) {
+      segments_push_text(&segments, STR_LIT("\n  sar rdx,"));
+      segments_push_i64(&segments, shift);
+    }
+
+    // Add one to negative quotients
+    segments_push_text(&segments, STR_LIT("\n  mov rax,rdx\n  shr rax,63\n  add rdx,rax"));
+
+    if (is_rem) {
+      if (fits_imm32(divisor)) {
+        segments_push_text(&segments, STR_LIT("\n  imul rdx,rdx,"));
+        segments_push_i64(&segments, divisor);
+      } else {
+        segments_push_text(&segments, STR_LIT("\n  mov rax,"));
+        segments_push_i64(&segments, divisor);
+        segments_push_text(&segments, STR_LIT("\n  imul rdx,rax"));
+      }
+
+      segments_push_text(&segments, STR_LIT("\n  mov rax,"));
+      segments_push_ir_arg(&segments, &arg, TargetLocKindImm, false);
+      segments_push_text(&segments, STR_LIT("\n  sub rax,rdx"));
+      segments_push_text(&segments, STR_LIT("\n  mov "));
+      segments_push_var(&segments, dest, TargetLocKindAny, true);
+      segments_push_text(&segments, STR_LIT(",rax"));
+    } else {
+      segments_push_text(&segments, STR_LIT("\n  mov "));
+      segments_push_var(&segments, dest, TargetLocKindAny, true);
+      segments_push_text(&segments, STR_LIT(",rdx"));
+    }
+  }
+
+  proc_inline_asm(proc, dest, ValueKindS64, segments);
+}
+
+static void proc_compile_shift_intrinsic(Procedure *proc, Str dest, Str op,
+                                         IrArg arg0, IrArg arg1) {
+  InlineAsmSegments segments = {0};
+  Str mnemonic = str_eq(op, STR_LIT("<<")) ? STR_LIT("shl ") : STR_LIT("sar ");
+  i64 count;
+
+  if (ir_arg_get_const(&arg1, &count)) {
+    proc_assign(proc, dest, ir_arg_to_arg(&arg0));
+
+    segments_push_text(&segments, mnemonic);
+    segments_push_var(&segments, dest, TargetLocKindNotImm, true);
+    segments_push_text(&segments, STR_LIT(","));
+    segments_push_i64(&segments, count & 63);
+  } else {
+    // Variable shift count has to be in `cl`, `rcx` is restored afterwards
     segments_push_text(&segments, STR_LIT("mov rax,"));
     segments_push_ir_arg(&segments, &arg0, TargetLocKindImm, false);
-    if (str_eq(op, STR_LIT("*")))
-      segments_push_text(&segments, STR_LIT("\n  imul "));
-    else
-      segments_push_text(&segments, STR_LIT("\n  idiv "));
+    segments_push_text(&segments, STR_LIT("\n  mov rdx,"));
     segments_push_ir_arg(&segments, &arg1, TargetLocKindImm, false);
+    segments_push_text(&segments, STR_LIT("\n  xchg rcx,rdx\n  "));
+    segments_push_text(&segments, mnemonic);
+    segments_push_text(&segments, STR_LIT("rax,cl\n  mov rcx,rdx\n  mov "));
+    segments_push_var(&segments, dest, TargetLocKindAny, true);
+    segments_push_text(&segments, STR_LIT(",rax"));
+  }
+
+  proc_inline_asm(proc, dest, ValueKindS64, segments);
+}
+
+static void segments_push_rhs(InlineAsmSegments *segments, IrArg *arg, bool is_in_rax) {
+  if (is_in_rax)
+    segments_push_text(segments, STR_LIT("rax"));
+  else
+    segments_push_ir_arg(segments, arg, TargetLocKindImm, false);
+}
+
+static void segments_push_disp(InlineAsmSegments *segments, i64 disp) {
+  if (disp < 0) {
+    segments_push_text(segments, STR_LIT("-"));
+    segments_push_i64(segments, -disp);
+  } else {
+    segments_push_text(segments, STR_LIT("+"));
+    segments_push_i64(segments, disp);
+  }
+}
+
+// `lea` computes the sum into a separate register, so the destination
+// does not have to be initialized with a copy of the first operand
+static bool proc_compile_lea_intrinsic(Procedure *proc, Str dest, Str op,
+                                       IrArg arg0, IrArg arg1) {
+  InlineAsmSegments segments = {0};
+  bool is_sub = str_eq(op, STR_LIT("-"));
+  i64 rhs;
+
+  if (arg0.kind != IrArgKindVar)
+    return false;
+
+  segments_push_text(&segments, STR_LIT("lea "));
+  segments_push_var(&segments, dest, TargetLocKindReg, true);
+  segments_push_text(&segments, STR_LIT(",["));
+  segments_push_ir_arg(&segments, &arg0, TargetLocKindReg, false);
+
+  if (ir_arg_get_const(&arg1, &rhs)) {
+    if (is_sub)
+      rhs = -(u64) rhs;
+
+    if (!fits_imm32(rhs))
+      return false;
+
+    segments_push_disp(&segments, rhs);
+  } else {
+    if (is_sub)
+      return false;
+
+    segments_push_text(&segments, STR_LIT("+"));
+    segments_push_ir_arg(&segments, &arg1, TargetLocKindReg, false);
+  }
+
+  segments_push_text(&segments, STR_LIT("]"));
+
+  proc_inline_asm(proc, dest, ValueKindS64, segments);
+  return true;
+}
+
+static bool bin_op_is_commutative(Str op) {
+  return str_eq(op, STR_LIT("+")) || str_eq(op, STR_LIT("*")) ||
+         str_eq(op, STR_LIT("&")) || str_eq(op, STR_LIT("|")) ||
+         str_eq(op, STR_LIT("^"));
+}
+
+void proc_compile_bin_intrinsic(Procedure *proc, Str dest, Str op, IrArg arg0, IrArg arg1) {
+  InlineAsmSegments segments = {0};
+
+  i64 lhs, rhs;
+  bool lhs_is_const = ir_arg_get_const(&arg0, &lhs);
+  bool rhs_is_const = ir_arg_get_const(&arg1, &rhs);
+  i64 result;
+
+  if (lhs_is_const && rhs_is_const && fold_bin_op(op, lhs, rhs, &result)) {
+    Arg arg = { ArgKindValue, { .value = value_new_s64(result) } };
+    proc_assign(proc, dest, arg);
+    return;
+  }
+
+  // Keep the constant on the right
+  if (lhs_is_const && !rhs_is_const && bin_op_is_commutative(op)) {
+    IrArg temp = arg0;
+    arg0 = arg1;
+    arg1 = temp;
+    rhs = lhs;
+    rhs_is_const = true;
+  }
+
+  if (str_eq(op, STR_LIT("*")) && rhs_is_const) {
+    proc_compile_mul_by_const(proc, dest, arg0, rhs);
+    return;
+  }
+
+  if ((str_eq(op, STR_LIT("/")) || str_eq(op, STR_LIT("%"))) && rhs_is_const) {
+    proc_compile_div_by_const(proc, dest, op, arg0, rhs);
+    return;
+  }
+
+  if (str_eq(op, STR_LIT("<<")) || str_eq(op, STR_LIT(">>"))) {
+    proc_compile_shift_intrinsic(proc, dest, op, arg0, arg1);
+    return;
+  }
+
+  // Two-operand instructions can work in place if the destination is
+  // one of the operands
+  if (!ir_arg_is_var(&arg0, dest) && ir_arg_is_var(&arg1, dest) &&
+      bin_op_is_commutative(op)) {
+    IrArg temp = arg0;
+    arg0 = arg1;
+    arg1 = temp;
+    rhs_is_const = false;
+  }
+
+  bool dest_is_arg0 = ir_arg_is_var(&arg0, dest);
+
+  if (!dest_is_arg0 && (str_eq(op, STR_LIT("+")) || str_eq(op, STR_LIT("-"))) &&
+      proc_compile_lea_intrinsic(proc, dest, op, arg0, arg1))
+    return;
+
+  if (str_eq(op, STR_LIT("*"))) {
+    if (!dest_is_arg0)
+      proc_assign(proc, dest, ir_arg_to_arg(&arg0));
+
+    segments_push_text(&segments, STR_LIT("imul "));
+    segments_push_var(&segments, dest, TargetLocKindReg, true);
+    segments_push_text(&segments, STR_LIT(","));
+    segments_push_ir_arg(&segments, &arg1, TargetLocKindNotImm, false);
+
+    proc_inline_asm(proc, dest, ValueKindS64, segments);
+    return;
+  }
+
+  // `idiv` reads the dividend from `rax`, so the destination is not
+  // initialized with it
+  if (str_eq(op, STR_LIT("/")) || str_eq(op, STR_LIT("%"))) {
+    segments_push_text(&segments, STR_LIT("mov rax,"));
+    segments_push_ir_arg(&segments, &arg0, TargetLocKindImm, false);
+    segments_push_text(&segments, STR_LIT("\n  cqo\n  idiv "));
+    segments_push_ir_arg(&segments, &arg1, TargetLocKindNotImm, false);
     segments_push_text(&segments, STR_LIT("\n  mov "));
     segments_push_var(&segments, dest, TargetLocKindAny, true);
     if (str_eq(op, STR_LIT("%")))
       segments_push_text(&segments, STR_LIT(",rdx"));
     else
       segments_push_text(&segments, STR_LIT(",rax"));
+
+    proc_inline_asm(proc, dest, ValueKindS64, segments);
+    return;
+  }
+
+  // Copying the first operand into the destination would overwrite the
+  // second one, so the result is computed in `rax`
+  if (!dest_is_arg0 && ir_arg_is_var(&arg1, dest)) {
+    segments_push_text(&segments, STR_LIT("mov rax,"));
+    segments_push_ir_arg(&segments, &arg0, TargetLocKindImm, false);
+    segments_push_text(&segments, STR_LIT("\n  sub rax,"));
+    segments_push_var(&segments, dest, TargetLocKindNotImm, false);
+    segments_push_text(&segments, STR_LIT("\n  mov "));
+    segments_push_var(&segments, dest, TargetLocKindAny, true);
+    segments_push_text(&segments, STR_LIT(",rax"));
+
+    proc_inline_asm(proc, dest, ValueKindS64, segments);
+    return;
+  }
+
+  if (!dest_is_arg0)
+    proc_assign(proc, dest, ir_arg_to_arg(&arg0));
+
+  // Only sign-extended 32-bit immediates can be encoded
+  bool rhs_is_in_rax = rhs_is_const && !fits_imm32(rhs);
+  if (rhs_is_in_rax) {
+    segments_push_text(&segments, STR_LIT("mov rax,"));
+    segments_push_i64(&segments, rhs);
+    segments_push_text(&segments, STR_LIT("\n  "));
+  }
+
+  if (str_eq(op, STR_LIT("+")) || str_eq(op, STR_LIT("-"))) {
+    if (str_eq(op, STR_LIT("+")))
+      segments_push_text(&segments, STR_LIT("add "));
+    else
+      segments_push_text(&segments, STR_LIT("sub "));
+    segments_push_var(&segments, dest, TargetLocKindNotImm, true);
+    segments_push_text(&segments, STR_LIT(","));
+    segments_push_rhs(&segments, &arg1, rhs_is_in_rax);
   } else if (str_eq(op, STR_LIT("&"))) {
     segments_push_text(&segments, STR_LIT("and "));
     segments_push_var(&segments, dest, TargetLocKindNotImm, true);
     segments_push_text(&segments, STR_LIT(","));
-    segments_push_ir_arg(&segments, &arg1, TargetLocKindImm, false);
+    segments_push_rhs(&segments, &arg1, rhs_is_in_rax);
   } else if (str_eq(op, STR_LIT("|"))) {
     segments_push_text(&segments, STR_LIT("or "));
     segments_push_var(&segments, dest, TargetLocKindNotImm, true);
     segments_push_text(&segments, STR_LIT(","));
-    segments_push_ir_arg(&segments, &arg1, TargetLocKindImm, false);
+    segments_push_rhs(&segments, &arg1, rhs_is_in_rax);
   } else if (str_eq(op, STR_LIT("^"))) {
     segments_push_text(&segments, STR_LIT("xor "));
     segments_push_var(&segments, dest, TargetLocKindNotImm, true);
     segments_push_text(&segments, STR_LIT(","));
-    segments_push_ir_arg(&segments, &arg1, TargetLocKindImm, false);
+    segments_push_rhs(&segments, &arg1, rhs_is_in_rax);
   } else {
     ERROR("Unknown binary operator: `"STR_FMT"`\n", STR_ARG(op));
     exit(1);
@@ -89,14 +530,77 @@ void proc_compile_un_intrinsic(Procedure *proc, Str dest, Str op, IrArg arg) {
   proc_inline_asm(proc, dest, ValueKindS64, segments);
 }
 
-void proc_compile_pre_assign_intrinsic(Procedure *proc, Str dest, Str op, IrArg arg) {
+// Pushes the `+ index * scale + offset` part of a memory operand. A
+// constant index that does not fit into a displacement is expected to
+// be in rax
+static void segments_push_index_disp(InlineAsmSegments *segments, IrArg *index,
+                                     u32 scale, i64 offset) {
+  i64 index_value;
+  i64 disp = offset;
+
+  if (index) {
+    if (ir_arg_get_const(index, &index_value) &&
+        fits_imm32(offset + (i64) ((u64) index_value * scale))) {
+      disp += (u64) index_value * scale;
+    } else {
+      segments_push_text(segments, STR_LIT("+"));
+      if (index->kind == IrArgKindValue)
+        segments_push_text(segments, STR_LIT("rax"));
+      else
+        segments_push_ir_arg(segments, index, TargetLocKindReg, false);
+
+      if (scale > 1) {
+        segments_push_text(segments, STR_LIT("*"));
+        segments_push_i64(segments, scale);
+      }
+    }
+  }
+
+  if (disp != 0)
+    segments_push_disp(segments, disp);
+}
+
+static void segments_push_wide_index(InlineAsmSegments *segments, IrArg *index,
+                                     u32 scale, i64 offset) {
+  i64 index_value;
+
+  if (index && ir_arg_get_const(index, &index_value) &&
+      !fits_imm32(offset + (i64) ((u64) index_value * scale))) {
+    segments_push_text(segments, STR_LIT("mov rax,"));
+    segments_push_i64(segments, index_value);
+    segments_push_text(segments, STR_LIT("\n  "));
+  }
+}
+
+void proc_compile_pre_assign_intrinsic(Procedure *proc, Str dest, Str op,
+                                       IrArg arg, Type *type, IrArg *index,
+                                       i64 offset) {
   InlineAsmSegments segments = {0};
+  TypeKind type_kind = type ? type->kind : TypeKindS64;
+  u32 scale = type_kinds_sizes_table[type_kind];
+  i64 value;
 
   if (str_eq(op, STR_LIT("*"))) {
-    segments_push_text(&segments, STR_LIT("mov qword["));
+    // Only sign-extended 32-bit immediates can be stored directly
+    bool arg_is_in_rdx = scale == 8 && ir_arg_get_const(&arg, &value) &&
+                         !fits_imm32(value);
+    if (arg_is_in_rdx) {
+      segments_push_text(&segments, STR_LIT("mov rdx,"));
+      segments_push_i64(&segments, value);
+      segments_push_text(&segments, STR_LIT("\n  "));
+    }
+
+    segments_push_wide_index(&segments, index, scale, offset);
+    segments_push_text(&segments, STR_LIT("mov "));
+    segments_push_text(&segments, type_kinds_ptr_prefixes_table[type_kind]);
+    segments_push_text(&segments, STR_LIT("["));
     segments_push_var(&segments, dest, TargetLocKindReg, true);
+    segments_push_index_disp(&segments, index, scale, offset);
     segments_push_text(&segments, STR_LIT("],"));
-    segments_push_ir_arg(&segments, &arg, TargetLocKindReg, false);
+    if (arg_is_in_rdx)
+      segments_push_text(&segments, STR_LIT("rdx"));
+    else
+      segments_push_ir_arg(&segments, &arg, TargetLocKindReg, false);
   } else {
     ERROR("Unknown pre-assign operator: `"STR_FMT"`\n", STR_ARG(op));
     exit(1);
@@ -105,20 +609,19 @@ void proc_compile_pre_assign_intrinsic(Procedure *proc, Str dest, Str op, IrArg
   proc_inline_asm(proc, dest, ValueKindUnit, segments);
 }
 
-void proc_compile_deref_intrinsic(Procedure *proc, Str dest, Type *type, IrArg arg) {
+void proc_compile_deref_intrinsic(Procedure *proc, Str dest, Type *type,
+                                  IrArg arg, IrArg *index, i64 offset) {
   InlineAsmSegments segments = {0};
+  u32 scale = type_kinds_sizes_table[type->kind];
 
+  segments_push_wide_index(&segments, index, scale, offset);
   segments_push_text(&segments, STR_LIT("mov "));
   segments_push_var(&segments, dest, TargetLocKindReg, true);
   segments_push_text(&segments, STR_LIT(","));
   segments_push_text(&segments, type_kinds_ptr_prefixes_table[type->kind]);
   segments_push_text(&segments, STR_LIT("["));
-  if (arg.kind == IrArgKindValue) {
-    Value value = ir_arg_value_to_value(&arg.as.value);
-    segments_push_text(&segments, value_to_str(value));
-  } else {
-    segments_push_var(&segments, arg.as.var, TargetLocKindReg, false);
-  }
+  segments_push_ir_arg(&segments, &arg, TargetLocKindReg, false);
+  segments_push_index_disp(&segments, index, scale, offset);
   segments_push_text(&segments, STR_LIT("]"));
 
   proc_inline_asm(proc, dest, type_kinds_value_kinds_table[type->kind], segments);
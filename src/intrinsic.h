@@ -4,9 +4,13 @@
 #include "mvm/src/mvm.h"
 #include "ir.h"
 
+bool fold_bin_op(Str op, i64 lhs, i64 rhs, i64 *result);
 void proc_compile_bin_intrinsic(Procedure *proc, Str dest, Str op, IrArg arg0, IrArg arg1);
 void proc_compile_un_intrinsic(Procedure *proc, Str dest, Str op, IrArg arg);
-void proc_compile_pre_assign_intrinsic(Procedure *proc, Str dest, Str op, IrArg arg);
-void proc_compile_deref_intrinsic(Procedure *proc, Str dest, Type *type, IrArg arg);
+void proc_compile_pre_assign_intrinsic(Procedure *proc, Str dest, Str op,
+                                       IrArg arg, Type *type, IrArg *index,
+                                       i64 offset);
+void proc_compile_deref_intrinsic(Procedure *proc, Str dest, Type *type,
+                                  IrArg arg, IrArg *index, i64 offset);
 
 #endif // INTRINSIC_H
@@ -19,6 +19,10 @@ typedef struct Type Type;
 struct Type {
   TypeKind  kind;
   Type     *ptr_target;
+  // Set if this is a pointer to a record
+  Str       record_name;
+  // Set if this is a local array of `ptr_target`
+  u32       array_len;
 };
 
 typedef enum {
@@ -100,6 +104,8 @@ typedef struct {
   RelOp rel_op;
   Str   begin_label_name;
   Str   end_label_name;
+  Str   body_label_name;
+  u32   unroll_factor;
 } IrInstrWhile;
 
 typedef struct {
@@ -139,9 +145,14 @@ typedef struct {
 } IrInstrUnOp;
 
 typedef struct {
-  Str dest;
-  Str op;
-  IrArg arg;
+  Str    dest;
+  Str    op;
+  IrArg  arg;
+  // Type of the stored value, 64-bit if NULL
+  Type  *type;
+  i64    offset;
+  bool   is_indexed;
+  IrArg  index;
 } IrInstrPreAssignOp;
 
 typedef struct {
@@ -154,6 +165,9 @@ typedef struct {
   Str    dest;
   Type  *type;
   IrArg  arg;
+  bool   is_indexed;
+  IrArg  index;
+  i64    offset;
 } IrInstrDeref;
 
 typedef union {
@@ -194,13 +208,14 @@ typedef struct {
   Type         *ret_val_type;
   bool          is_naked;
   bool          is_inlined;
+  bool          is_noinline;
 } IrProc;
 
 typedef Da(IrProc) IrProcs;
 
 typedef struct {
-  Str   name;
-  Value value;
+  Str        name;
+  IrArgValue value;
 } StaticVariable;
 
 typedef Da(StaticVariable) StaticVariables;
@@ -222,5 +237,6 @@ typedef struct {
 // Defined in compiler.c
 extern ValueKind type_kinds_value_kinds_table[TypeKindsCount];
 extern Str type_kinds_ptr_prefixes_table[TypeKindsCount];
+extern u32 type_kinds_sizes_table[TypeKindsCount];
 
 #endif // IR_H
@@ -8,7 +8,9 @@
 #include "io.h"
 #include "parser.h"
 #include "ir.h"
+#include "optimizer.h"
 #include "compiler.h"
+#include "interpreter.h"
 #define SHL_STR_IMPLEMENTATION
 #include "shl/shl-str.h"
 #define SHL_ARENA_IMPLEMENTATION
@@ -30,6 +32,36 @@ static Str get_file_dir(Str path) {
   return (Str) {0};
 }
 
+// `-DNAME=VALUE` replaces the initial value of a static variable, so
+// switches like `MEM_PROFILE` can be set without editing the source
+static void ir_define_static_var(Ir *ir, char *define) {
+  char *eq = strchr(define, '=');
+  if (!eq || eq == define) {
+    ERROR("Expected -DNAME=VALUE, got -D%s\n", define);
+    exit(1);
+  }
+
+  Str name = { define, eq - define };
+  char *end;
+  i64 value = strtoll(eq + 1, &end, 0);
+  if (*end != '\0' || end == eq + 1) {
+    ERROR("Value of `"STR_FMT"` should be a number\n", STR_ARG(name));
+    exit(1);
+  }
+
+  for (u32 i = 0; i < ir->static_vars.len; ++i) {
+    StaticVariable *var = ir->static_vars.items + i;
+
+    if (str_eq(var->name, name)) {
+      var->value = ir_arg_value_new(var->value.type, value);
+      return;
+    }
+  }
+
+  ERROR("Unknown static variable: `"STR_FMT"`\n", STR_ARG(name));
+  exit(1);
+}
+
 int main(i32 argv, i8 **argc) {
   if (argv < 2) {
     ERROR("Output file was not provided\n");
@@ -42,8 +74,18 @@ int main(i32 argv, i8 **argc) {
   }
 
   bool silent_mode = false;
-  if (argv > 3 && strcmp(argc[3], "-s") == 0)
-    silent_mode = true;
+  Da(char *) defines = {0};
+
+  for (i32 i = 3; i < argv; ++i) {
+    if (strcmp(argc[i], "-s") == 0) {
+      silent_mode = true;
+    } else if (strncmp(argc[i], "-D", 2) == 0) {
+      DA_APPEND(defines, argc[i] + 2);
+    } else {
+      ERROR("Unknown flag: %s\n", argc[i]);
+      exit(1);
+    }
+  }
 
   Str text = read_file(argc[2]);
   if (!text.ptr) {
@@ -102,6 +144,11 @@ int main(i32 argv, i8 **argc) {
   }
 
   Ir ir = parse(&tokens);
+
+  for (u32 i = 0; i < defines.len; ++i)
+    ir_define_static_var(&ir, defines.items[i]);
+
+  optimize_ir(&ir);
   Program program = compile_ir(&ir);
 
   program_optimize(&program, Arch_X86_64);
@@ -0,0 +1,1512 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimizer.h"
+#include "analysis.h"
+#include "interpreter.h"
+#include "shl/shl-log.h"
+
+#define AUTO_UNROLL_FACTOR       4
+#define AUTO_UNROLL_MAX_BODY_LEN 16
+
+#define AUTO_INLINE_MAX_INSTRS_COUNT               8
+#define AUTO_INLINE_SINGLE_CALLER_MAX_INSTRS_COUNT 64
+
+typedef Da(Str) LabelNames;
+
+typedef struct {
+  Ir  *ir;
+  u32  tmp_vars_count;
+  u32  labels_count;
+} Optimizer;
+
+static Type s64_type = { TypeKindS64, NULL, {0}, 0 };
+
+static IrArg ir_arg_new_s64(i64 value) {
+  return (IrArg) {
+    IrArgKindValue,
+    { .value = { &s64_type, { ._s64 = value } } },
+  };
+}
+
+static Str str_with_suffix(Str str, char *suffix, u32 index) {
+  StringBuilder sb = {0};
+  sb_push_str(&sb, str);
+  sb_push(&sb, suffix);
+  sb_push_u32(&sb, index);
+
+  return sb_to_str(sb);
+}
+
+static Str optimizer_new_tmp_var(Optimizer *optimizer) {
+  return str_with_suffix(STR_LIT("?tmp"), "", optimizer->tmp_vars_count++);
+}
+
+static RelOp rel_op_swap(RelOp rel_op) {
+  switch (rel_op) {
+  case RelOpLess:           return RelOpGreater;
+  case RelOpGreater:        return RelOpLess;
+  case RelOpLessOrEqual:    return RelOpGreaterOrEqual;
+  case RelOpGreaterOrEqual: return RelOpLessOrEqual;
+  default:                  return rel_op;
+  }
+}
+
+static bool ir_arg_is_const_or_static(Ir *ir, IrArg *arg) {
+  return arg->kind == IrArgKindValue || ir_is_static_var(ir, arg->as.var);
+}
+
+// A comparison needs at least one operand in a register or in memory
+static bool ir_cmp_stays_non_const(Ir *ir, IrArg *arg0, IrArg *arg1, Str name) {
+  if (ir_arg_is_var(arg0, name))
+    return !ir_arg_is_const_or_static(ir, arg1);
+
+  if (ir_arg_is_var(arg1, name))
+    return !ir_arg_is_const_or_static(ir, arg0);
+
+  return true;
+}
+
+static bool ir_static_var_is_const(Ir *ir, Str name) {
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+
+    if (ir_proc_var_is_address_taken(proc, name))
+      return false;
+
+    for (u32 j = 0; j < proc->instrs.len; ++j) {
+      IrInstr *instr = proc->instrs.items + j;
+
+      if (ir_instr_defines_var(instr, name))
+        return false;
+
+      switch (instr->kind) {
+      case IrInstrKindPreAssignOp: {
+        if (str_eq(instr->as.pre_assign_op.dest, name))
+          return false;
+      } break;
+
+      case IrInstrKindDeref: {
+        if (ir_arg_is_var(&instr->as.deref.arg, name))
+          return false;
+      } break;
+
+      // Comparisons with immediates are decided by `fold_const_ifs`
+      case IrInstrKindIf: {
+        IrInstrIf *_if = &instr->as._if;
+        if (!ir_cmp_stays_non_const(ir, &_if->arg0, &_if->arg1, name) &&
+            _if->arg0.kind != IrArgKindValue &&
+            _if->arg1.kind != IrArgKindValue)
+          return false;
+      } break;
+
+      case IrInstrKindWhile: {
+        IrInstrWhile *_while = &instr->as._while;
+        if (!ir_cmp_stays_non_const(ir, &_while->arg0, &_while->arg1, name))
+          return false;
+      } break;
+
+      default: {}
+      }
+    }
+  }
+
+  return true;
+}
+
+static void substitute_static_var(Ir *ir, StaticVariable *var) {
+  IrArg value_arg = { IrArgKindValue, { .value = var->value } };
+
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+
+    for (u32 j = 0; j < proc->instrs.len; ++j) {
+      IrInstr *instr = proc->instrs.items + j;
+
+      if (instr->kind == IrInstrKindCast &&
+          ir_arg_is_var(&instr->as.cast.arg, var->name)) {
+        IrInstrCast *cast = &instr->as.cast;
+        i64 value = 0;
+        ir_arg_get_const(&value_arg, &value);
+
+        IrArg arg = { IrArgKindValue, { .value = ir_arg_value_new(cast->type, value) } };
+        *instr = (IrInstr) { IrInstrKindAssign, { .assign = { cast->dest, arg } } };
+        continue;
+      }
+
+      // Keep the immediate on the right of comparisons
+      if (instr->kind == IrInstrKindIf &&
+          ir_arg_is_var(&instr->as._if.arg0, var->name)) {
+        IrInstrIf *_if = &instr->as._if;
+        IrArg temp = _if->arg0;
+        _if->arg0 = _if->arg1;
+        _if->arg1 = temp;
+        _if->rel_op = rel_op_swap(_if->rel_op);
+      } else if (instr->kind == IrInstrKindWhile &&
+                 ir_arg_is_var(&instr->as._while.arg0, var->name)) {
+        IrInstrWhile *_while = &instr->as._while;
+        IrArg temp = _while->arg0;
+        _while->arg0 = _while->arg1;
+        _while->arg1 = temp;
+        _while->rel_op = rel_op_swap(_while->rel_op);
+      }
+
+      ir_instr_replace_var(instr, var->name, value_arg);
+    }
+  }
+}
+
+// Statics that are never written are replaced by immediates and do
+// not get any storage
+static void propagate_static_consts(Ir *ir) {
+  u32 new_len = 0;
+
+  for (u32 i = 0; i < ir->static_vars.len; ++i) {
+    StaticVariable *var = ir->static_vars.items + i;
+
+    if (ir_static_var_is_const(ir, var->name))
+      substitute_static_var(ir, var);
+    else
+      ir->static_vars.items[new_len++] = *var;
+  }
+
+  ir->static_vars.len = new_len;
+}
+
+// Compile-time switches leave comparisons of two immediates behind,
+// they become unconditional jumps or disappear
+static void fold_const_ifs(IrProc *proc) {
+  u32 new_len = 0;
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+    i64 lhs, rhs;
+
+    if (instr->kind == IrInstrKindIf &&
+        ir_arg_get_const(&instr->as._if.arg0, &lhs) &&
+        ir_arg_get_const(&instr->as._if.arg1, &rhs)) {
+      if (!ir_eval_rel_op(instr->as._if.rel_op, lhs, rhs))
+        continue;
+
+      Str label_name = instr->as._if.label_name;
+      *instr = (IrInstr) { IrInstrKindJump, { .jump = { label_name } } };
+    }
+
+    proc->instrs.items[new_len++] = *instr;
+  }
+
+  proc->instrs.len = new_len;
+}
+
+// `at_exit` runs before `main` returns and before every call to `exit`
+static void insert_exit_hooks(Ir *ir) {
+  IrProc *hook = ir_find_proc(ir, STR_LIT("at_exit"), 0);
+  if (!hook)
+    return;
+
+  IrInstr hook_call = { IrInstrKindCall, { .call = { hook->name, {0}, {0} } } };
+
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+    if (proc == hook || proc->is_naked)
+      continue;
+
+    bool is_main = str_eq(proc->name, STR_LIT("main"));
+    IrInstrs new_instrs = {0};
+
+    for (u32 j = 0; j < proc->instrs.len; ++j) {
+      IrInstr *instr = proc->instrs.items + j;
+
+      bool is_exit = instr->kind == IrInstrKindCall &&
+                     str_eq(instr->as.call.callee_name, STR_LIT("exit")) &&
+                     instr->as.call.args.len == 1;
+      bool is_main_ret = is_main && (instr->kind == IrInstrKindRet ||
+                                     instr->kind == IrInstrKindRetVal);
+
+      if (is_exit || is_main_ret)
+        DA_APPEND(new_instrs, hook_call);
+      DA_APPEND(new_instrs, *instr);
+    }
+
+    // `main` can also return by reaching its end
+    if (is_main)
+      DA_APPEND(new_instrs, hook_call);
+
+    proc->instrs = new_instrs;
+  }
+}
+
+static bool loop_writes_memory(IrInstrs *instrs, u32 begin, u32 end) {
+  for (u32 i = begin; i <= end; ++i)
+    if (ir_instr_may_write_memory(instrs->items + i))
+      return true;
+
+  return false;
+}
+
+static bool loop_var_is_invariant(Ir *ir, IrProc *proc, Str name,
+                                  u32 begin, u32 end) {
+  for (u32 i = begin; i <= end; ++i)
+    if (ir_instr_defines_var(proc->instrs.items + i, name))
+      return false;
+
+  // Static and address-taken variables can be changed behind our back
+  if (ir_is_static_var(ir, name) || ir_proc_var_is_address_taken(proc, name))
+    return !loop_writes_memory(&proc->instrs, begin, end);
+
+  return true;
+}
+
+static bool loop_arg_is_invariant(Ir *ir, IrProc *proc, IrArg *arg,
+                                  u32 begin, u32 end) {
+  if (arg->kind == IrArgKindValue)
+    return true;
+
+  return loop_var_is_invariant(ir, proc, arg->as.var, begin, end);
+}
+
+// Hoisted instructions are executed even if the loop body is not,
+// so they must not be able to trap
+static bool ir_instr_is_speculatable(IrInstr *instr) {
+  switch (instr->kind) {
+  case IrInstrKindAssign:
+  case IrInstrKindCast:
+  case IrInstrKindUnOp: return true;
+
+  case IrInstrKindBinOp: {
+    Str op = instr->as.bin_op.op;
+    if (!str_eq(op, STR_LIT("/")) && !str_eq(op, STR_LIT("%")))
+      return true;
+
+    i64 divisor;
+    if (!ir_arg_get_const(&instr->as.bin_op.arg1, &divisor))
+      return false;
+
+    return divisor != 0 && divisor != -1;
+  }
+
+  default: return false;
+  }
+}
+
+static bool licm_instr_is_hoistable(Ir *ir, IrProc *proc, u32 begin,
+                                    u32 end, u32 index) {
+  IrInstr *instr = proc->instrs.items + index;
+
+  if (!ir_instr_is_speculatable(instr))
+    return false;
+
+  Str dest = *ir_instr_dest(instr);
+
+  if (ir_is_static_var(ir, dest) || ir_proc_var_is_address_taken(proc, dest))
+    return false;
+
+  // Every other reference to the destination has to be a use that is
+  // located inside of the loop after the hoisted definition
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    if (i == index)
+      continue;
+
+    IrInstr *other = proc->instrs.items + i;
+    if (!ir_instr_refers_var(other, dest))
+      continue;
+
+    if (i <= index || i >= end || ir_instr_defines_var(other, dest))
+      return false;
+  }
+
+  switch (instr->kind) {
+  case IrInstrKindAssign: {
+    return loop_arg_is_invariant(ir, proc, &instr->as.assign.arg, begin, end);
+  }
+
+  case IrInstrKindCast: {
+    return loop_arg_is_invariant(ir, proc, &instr->as.cast.arg, begin, end);
+  }
+
+  case IrInstrKindBinOp: {
+    return loop_arg_is_invariant(ir, proc, &instr->as.bin_op.arg0, begin, end) &&
+           loop_arg_is_invariant(ir, proc, &instr->as.bin_op.arg1, begin, end);
+  }
+
+  case IrInstrKindUnOp: {
+    // Address of a variable does not depend on its value
+    if (str_eq(instr->as.un_op.op, STR_LIT("&")))
+      return true;
+
+    return loop_arg_is_invariant(ir, proc, &instr->as.un_op.arg, begin, end);
+  }
+
+  default: return false;
+  }
+}
+
+static bool licm_hoist_one(Ir *ir, IrProc *proc) {
+  IrInstrs *instrs = &proc->instrs;
+
+  for (u32 i = 0; i < instrs->len; ++i) {
+    if (instrs->items[i].kind != IrInstrKindWhile)
+      continue;
+
+    Str end_label_name = instrs->items[i].as._while.end_label_name;
+    u32 end = ir_instrs_find_label(instrs, end_label_name, i + 1);
+    if (end == instrs->len)
+      continue;
+
+    // Only instructions that are not nested into another block are
+    // executed on every iteration, so the rest is left in place
+    LabelNames open_labels = {0};
+
+    for (u32 j = i + 1; j < end; ++j) {
+      IrInstr *instr = instrs->items + j;
+
+      if (instr->kind == IrInstrKindIf) {
+        DA_APPEND(open_labels, instr->as._if.label_name);
+        continue;
+      }
+
+      if (instr->kind == IrInstrKindWhile) {
+        DA_APPEND(open_labels, instr->as._while.end_label_name);
+        continue;
+      }
+
+      if (instr->kind == IrInstrKindLabel) {
+        if (open_labels.len > 0 &&
+            str_eq(open_labels.items[open_labels.len - 1], instr->as.label.name))
+          --open_labels.len;
+        continue;
+      }
+
+      if (open_labels.len > 0)
+        continue;
+
+      if (!licm_instr_is_hoistable(ir, proc, i, end, j))
+        continue;
+
+      // Move the instruction right before the loop header
+      IrInstr hoisted = *instr;
+      memmove(instrs->items + i + 1, instrs->items + i, (j - i) * sizeof(IrInstr));
+      instrs->items[i] = hoisted;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void hoist_loop_invariants(Ir *ir, IrProc *proc) {
+  while (licm_hoist_one(ir, proc));
+}
+
+static bool loop_is_counted(Ir *ir, IrProc *proc, u32 begin, u32 end) {
+  IrInstrWhile *_while = &proc->instrs.items[begin].as._while;
+
+  // `i < bound` is stored as the exit condition `i >= bound`
+  if (_while->rel_op != RelOpGreaterOrEqual || _while->arg0.kind != IrArgKindVar)
+    return false;
+
+  Str induction_var = _while->arg0.as.var;
+
+  if (ir_arg_is_var(&_while->arg1, induction_var) ||
+      !loop_arg_is_invariant(ir, proc, &_while->arg1, begin, end))
+    return false;
+
+  if (ir_is_static_var(ir, induction_var) ||
+      ir_proc_var_is_address_taken(proc, induction_var))
+    return false;
+
+  // The only definition has to be `i = i + 1` on the top level of the body
+  u32 step_index = end;
+  LabelNames open_labels = {0};
+
+  for (u32 i = begin + 1; i < end; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+
+    if (instr->kind == IrInstrKindIf)
+      DA_APPEND(open_labels, instr->as._if.label_name);
+    else if (instr->kind == IrInstrKindWhile)
+      DA_APPEND(open_labels, instr->as._while.end_label_name);
+    else if (instr->kind == IrInstrKindLabel &&
+             open_labels.len > 0 &&
+             str_eq(open_labels.items[open_labels.len - 1], instr->as.label.name))
+      --open_labels.len;
+
+    if (!ir_instr_defines_var(instr, induction_var))
+      continue;
+
+    if (step_index != end || open_labels.len > 0 ||
+        instr->kind != IrInstrKindBinOp)
+      return false;
+
+    IrInstrBinOp *bin_op = &instr->as.bin_op;
+    i64 step;
+
+    if (!str_eq(bin_op->op, STR_LIT("+")) ||
+        !ir_arg_is_var(&bin_op->arg0, induction_var) ||
+        !ir_arg_get_const(&bin_op->arg1, &step) || step != 1)
+      return false;
+
+    step_index = i;
+  }
+
+  return step_index != end;
+}
+
+static IrInstr unroll_copy_instr(IrInstr *instr, LabelNames *body_labels,
+                                 u32 copy_index) {
+  IrInstr copy = *instr;
+  Str *label_names[3] = {0};
+
+  switch (copy.kind) {
+  case IrInstrKindIf: {
+    label_names[0] = &copy.as._if.label_name;
+  } break;
+
+  case IrInstrKindWhile: {
+    label_names[0] = &copy.as._while.begin_label_name;
+    label_names[1] = &copy.as._while.end_label_name;
+    label_names[2] = &copy.as._while.body_label_name;
+  } break;
+
+  case IrInstrKindJump: {
+    label_names[0] = &copy.as.jump.label_name;
+  } break;
+
+  case IrInstrKindLabel: {
+    label_names[0] = &copy.as.label.name;
+  } break;
+
+  default: {}
+  }
+
+  // Labels of the body are duplicated, jumps out of it are kept as is
+  for (u32 i = 0; i < ARRAY_LEN(label_names); ++i) {
+    if (!label_names[i])
+      continue;
+
+    for (u32 j = 0; j < body_labels->len; ++j) {
+      if (str_eq(*label_names[i], body_labels->items[j])) {
+        *label_names[i] = str_with_suffix(*label_names[i], "_u", copy_index);
+        break;
+      }
+    }
+  }
+
+  return copy;
+}
+
+static void unroll_loop(Optimizer *optimizer, IrProc *proc, u32 begin,
+                        u32 end, u32 factor, bool is_counted) {
+  IrInstrs *instrs = &proc->instrs;
+  IrInstrWhile _while = instrs->items[begin].as._while;
+  _while.unroll_factor = 1;
+
+  LabelNames body_labels = {0};
+  for (u32 i = begin + 1; i + 1 < end; ++i) {
+    IrInstr *instr = instrs->items + i;
+
+    if (instr->kind == IrInstrKindLabel) {
+      DA_APPEND(body_labels, instr->as.label.name);
+    } else if (instr->kind == IrInstrKindWhile) {
+      DA_APPEND(body_labels, instr->as._while.begin_label_name);
+      DA_APPEND(body_labels, instr->as._while.end_label_name);
+      DA_APPEND(body_labels, instr->as._while.body_label_name);
+    }
+  }
+
+  IrInstrs new_instrs = {0};
+
+  for (u32 i = 0; i < begin; ++i)
+    DA_APPEND(new_instrs, instrs->items[i]);
+
+  if (is_counted) {
+    // Main loop runs while all of the copies are in bounds, the original
+    // loop handles the remainder
+    IrArg limit;
+    i64 bound;
+
+    if (ir_arg_get_const(&_while.arg1, &bound)) {
+      limit = ir_arg_new_s64(bound - (factor - 1));
+    } else {
+      Str limit_name = optimizer_new_tmp_var(optimizer);
+      IrInstr limit_instr = {
+        IrInstrKindBinOp,
+        {
+          .bin_op = {
+            limit_name,
+            STR_LIT("-"),
+            _while.arg1,
+            ir_arg_new_s64(factor - 1),
+          },
+        },
+      };
+      DA_APPEND(new_instrs, limit_instr);
+
+      limit = (IrArg) { IrArgKindVar, { .var = limit_name } };
+    }
+
+    IrInstrWhile main_while = {
+      _while.arg0,
+      limit,
+      _while.rel_op,
+      str_with_suffix(_while.begin_label_name, "_m", 0),
+      str_with_suffix(_while.end_label_name, "_m", 0),
+      str_with_suffix(_while.body_label_name, "_m", 0),
+      1,
+    };
+    IrInstr main_while_instr = { IrInstrKindWhile, { ._while = main_while } };
+    DA_APPEND(new_instrs, main_while_instr);
+
+    for (u32 i = 0; i < factor; ++i)
+      for (u32 j = begin + 1; j + 1 < end; ++j)
+        DA_APPEND(new_instrs, unroll_copy_instr(instrs->items + j, &body_labels, i));
+
+    IrInstr jump = { IrInstrKindJump, { .jump = { main_while.begin_label_name } } };
+    DA_APPEND(new_instrs, jump);
+    IrInstr label = { IrInstrKindLabel, { .label = { main_while.end_label_name } } };
+    DA_APPEND(new_instrs, label);
+
+    IrInstr while_instr = { IrInstrKindWhile, { ._while = _while } };
+    DA_APPEND(new_instrs, while_instr);
+
+    for (u32 i = begin + 1; i <= end; ++i)
+      DA_APPEND(new_instrs, instrs->items[i]);
+  } else {
+    // Copies are separated by an exit check
+    IrInstr while_instr = { IrInstrKindWhile, { ._while = _while } };
+    DA_APPEND(new_instrs, while_instr);
+
+    for (u32 i = 0; i < factor; ++i) {
+      if (i > 0) {
+        IrInstr check = {
+          IrInstrKindIf,
+          { ._if = { _while.arg0, _while.arg1, _while.rel_op, _while.end_label_name } },
+        };
+        DA_APPEND(new_instrs, check);
+      }
+
+      for (u32 j = begin + 1; j + 1 < end; ++j)
+        DA_APPEND(new_instrs, unroll_copy_instr(instrs->items + j, &body_labels, i));
+    }
+
+    for (u32 i = end - 1; i <= end; ++i)
+      DA_APPEND(new_instrs, instrs->items[i]);
+  }
+
+  for (u32 i = end + 1; i < instrs->len; ++i)
+    DA_APPEND(new_instrs, instrs->items[i]);
+
+  *instrs = new_instrs;
+}
+
+static bool unroll_one(Optimizer *optimizer, IrProc *proc) {
+  IrInstrs *instrs = &proc->instrs;
+
+  for (u32 i = 0; i < instrs->len; ++i) {
+    if (instrs->items[i].kind != IrInstrKindWhile)
+      continue;
+
+    IrInstrWhile *_while = &instrs->items[i].as._while;
+    if (_while->unroll_factor == 1)
+      continue;
+
+    u32 end = ir_instrs_find_label(instrs, _while->end_label_name, i + 1);
+    if (end == instrs->len)
+      continue;
+
+    IrInstr *back_edge = instrs->items + end - 1;
+    if (back_edge->kind != IrInstrKindJump ||
+        !str_eq(back_edge->as.jump.label_name, _while->begin_label_name))
+      continue;
+
+    // Duplicated declarations and assembly (which may define labels)
+    // cannot be copied, such loops keep their hint unused
+    bool is_unrollable = true;
+    bool has_nested_loops = false;
+
+    for (u32 j = i + 1; j + 1 < end; ++j) {
+      IrInstrKind kind = instrs->items[j].kind;
+
+      if (kind == IrInstrKindCreate || kind == IrInstrKindAsm)
+        is_unrollable = false;
+      else if (kind == IrInstrKindWhile)
+        has_nested_loops = true;
+    }
+
+    u32 factor = _while->unroll_factor;
+    bool is_counted = loop_is_counted(optimizer->ir, proc, i, end);
+
+    if (factor == 0 && (!is_counted || has_nested_loops ||
+                        end - i - 2 > AUTO_UNROLL_MAX_BODY_LEN))
+      is_unrollable = false;
+
+    if (!is_unrollable) {
+      _while->unroll_factor = 1;
+      continue;
+    }
+
+    if (factor == 0)
+      factor = AUTO_UNROLL_FACTOR;
+
+    unroll_loop(optimizer, proc, i, end, factor, is_counted);
+
+    return true;
+  }
+
+  return false;
+}
+
+static void unroll_loops(Optimizer *optimizer, IrProc *proc) {
+  while (unroll_one(optimizer, proc));
+}
+
+static bool ir_proc_has_param(IrProc *proc, Str name) {
+  for (u32 i = 0; i < proc->params.len; ++i)
+    if (str_eq(proc->params.items[i].name, name))
+      return true;
+
+  return false;
+}
+
+static bool ir_proc_var_is_local(Ir *ir, IrProc *proc, Str name) {
+  return !ir_is_static_var(ir, name) &&
+         !ir_proc_has_param(proc, name) &&
+         !ir_proc_var_is_address_taken(proc, name);
+}
+
+// In `dest = temp op arg` the destination can take over the location of
+// `temp` if the latter is computed and consumed inside of the same basic
+// block, so the operation is done in place instead of on a copy
+static bool coalesce_one(Ir *ir, IrProc *proc) {
+  IrInstrs *instrs = &proc->instrs;
+
+  for (u32 i = 0; i < instrs->len; ++i) {
+    IrInstr *instr = instrs->items + i;
+    if (instr->kind != IrInstrKindBinOp)
+      continue;
+
+    IrInstrBinOp *bin_op = &instr->as.bin_op;
+    if (bin_op->arg0.kind != IrArgKindVar)
+      continue;
+
+    Str temp = bin_op->arg0.as.var;
+    Str dest = bin_op->dest;
+
+    if (str_eq(temp, dest) || ir_arg_is_var(&bin_op->arg1, dest) ||
+        !ir_proc_var_is_local(ir, proc, temp) ||
+        !ir_proc_var_is_local(ir, proc, dest))
+      continue;
+
+    // Binary operations always produce a 64-bit value, so only their
+    // results are reused to keep the kind of the variable the same
+    u32 temp_def = i;
+    for (u32 j = i; j > 0; --j) {
+      IrInstr *prev = instrs->items + j - 1;
+      if (ir_instr_is_control_flow(prev))
+        break;
+
+      if (!ir_instr_refers_var(prev, temp))
+        continue;
+
+      if (prev->kind == IrInstrKindBinOp &&
+          str_eq(prev->as.bin_op.dest, temp) &&
+          !ir_instr_uses_var(prev, temp))
+        temp_def = j - 1;
+      break;
+    }
+
+    bool is_coalescable = temp_def != i;
+
+    for (u32 j = 0; j < instrs->len && is_coalescable; ++j) {
+      IrInstr *other = instrs->items + j;
+
+      if (ir_instr_refers_var(other, temp) && (j < temp_def || j > i))
+        is_coalescable = false;
+
+      if (j < i && ir_instr_refers_var(other, dest))
+        is_coalescable = false;
+
+      if (j > i && ir_instr_defines_var(other, dest))
+        is_coalescable = false;
+    }
+
+    if (!is_coalescable)
+      continue;
+
+    for (u32 j = i; j < instrs->len; ++j)
+      ir_instr_rename_var(instrs->items + j, dest, temp);
+
+    return true;
+  }
+
+  return false;
+}
+
+static void coalesce_bin_op_dests(Ir *ir, IrProc *proc) {
+  while (coalesce_one(ir, proc));
+}
+
+// Finds the type kind every definition of a variable agrees on.
+// Results of arithmetic are 64-bit, calls are not followed
+static bool ir_proc_var_type_kind(Ir *ir, IrProc *proc, Str name, TypeKind *kind) {
+  bool is_known = false;
+
+  for (u32 i = 0; i < proc->params.len; ++i) {
+    if (str_eq(proc->params.items[i].name, name)) {
+      *kind = proc->params.items[i].type->kind;
+      is_known = true;
+    }
+  }
+
+  for (u32 i = 0; i < ir->static_vars.len; ++i) {
+    if (str_eq(ir->static_vars.items[i].name, name)) {
+      *kind = ir->static_vars.items[i].value.type->kind;
+      is_known = true;
+    }
+  }
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+    if (!ir_instr_defines_var(instr, name))
+      continue;
+
+    Type *type = NULL;
+
+    switch (instr->kind) {
+    case IrInstrKindCreate: type = instr->as.create.dest_type; break;
+    case IrInstrKindAsm:    type = instr->as._asm.dest_type; break;
+    case IrInstrKindCast:   type = instr->as.cast.type; break;
+    case IrInstrKindDeref:  type = instr->as.deref.type; break;
+    case IrInstrKindBinOp:  type = &s64_type; break;
+
+    case IrInstrKindAssign: {
+      if (instr->as.assign.arg.kind == IrArgKindValue)
+        type = instr->as.assign.arg.as.value.type;
+    } break;
+
+    default: {}
+    }
+
+    if (!type || (is_known && type->kind != *kind) ||
+        (instr->kind == IrInstrKindAsm && !str_eq(instr->as._asm.dest, name)))
+      return false;
+
+    *kind = type->kind;
+    is_known = true;
+  }
+
+  return is_known;
+}
+
+// A narrow store takes its value from a register of the same size, so
+// variables of a different size are cast to the stored type first
+static void cast_narrow_stores(Optimizer *optimizer, IrProc *proc) {
+  IrInstrs new_instrs = {0};
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr instr = proc->instrs.items[i];
+    IrInstrPreAssignOp *store = &instr.as.pre_assign_op;
+    TypeKind kind;
+
+    if (instr.kind == IrInstrKindPreAssignOp && store->type &&
+        type_kinds_sizes_table[store->type->kind] < 8 &&
+        store->arg.kind == IrArgKindVar &&
+        !(ir_proc_var_type_kind(optimizer->ir, proc, store->arg.as.var, &kind) &&
+          type_kinds_sizes_table[kind] == type_kinds_sizes_table[store->type->kind])) {
+      Str tmp = optimizer_new_tmp_var(optimizer);
+      IrInstr cast = { IrInstrKindCast, { .cast = { tmp, store->type, store->arg } } };
+      DA_APPEND(new_instrs, cast);
+      store->arg = (IrArg) { IrArgKindVar, { .var = tmp } };
+    }
+
+    DA_APPEND(new_instrs, instr);
+  }
+
+  proc->instrs = new_instrs;
+}
+
+static bool ir_proc_is_tail_position(IrProc *proc, u32 index) {
+  for (u32 i = index + 1; i < proc->instrs.len; ++i) {
+    IrInstrKind kind = proc->instrs.items[i].kind;
+
+    if (kind == IrInstrKindRet)
+      return true;
+
+    if (kind != IrInstrKindLabel)
+      return false;
+  }
+
+  return true;
+}
+
+// Returns the number of instructions that form a tail call to the
+// procedure itself, or 0 if there is none at the index
+static u32 ir_proc_self_tail_call_len(IrProc *proc, u32 index) {
+  IrInstr *instr = proc->instrs.items + index;
+
+  if (instr->kind != IrInstrKindCall ||
+      !str_eq(instr->as.call.callee_name, proc->name) ||
+      instr->as.call.args.len != proc->params.len)
+    return 0;
+
+  Str dest = instr->as.call.dest;
+  if (dest.len == 0)
+    return ir_proc_is_tail_position(proc, index) ? 1 : 0;
+
+  // `t = f(...)` directly followed by `retval t`
+  if (index + 1 >= proc->instrs.len)
+    return 0;
+
+  IrInstr *next = proc->instrs.items + index + 1;
+  if (next->kind != IrInstrKindRetVal || !ir_arg_is_var(&next->as.ret_val.arg, dest))
+    return 0;
+
+  for (u32 i = 0; i < proc->instrs.len; ++i)
+    if (i != index && i != index + 1 && ir_instr_refers_var(proc->instrs.items + i, dest))
+      return 0;
+
+  return 2;
+}
+
+// Frame objects are allocated by assembly at the very beginning of the
+// procedure, see ir_proc_alloc_frame_object
+static bool ir_instr_is_frame_alloc(IrInstr *instr) {
+  Str prefix = STR_LIT("sub rsp,");
+
+  return instr->kind == IrInstrKindAsm &&
+         instr->as._asm.code.len >= prefix.len &&
+         memcmp(instr->as._asm.code.ptr, prefix.ptr, prefix.len) == 0;
+}
+
+static bool var_names_contain(VarNames *names, Str name) {
+  for (u32 i = 0; i < names->len; ++i)
+    if (str_eq(names->items[i], name))
+      return true;
+
+  return false;
+}
+
+// Frame objects and every variable computed from their addresses
+static VarNames ir_proc_frame_pointers(IrProc *proc) {
+  VarNames names = {0};
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+    if (ir_instr_is_frame_alloc(instr))
+      DA_APPEND(names, instr->as._asm.dest);
+  }
+
+  bool changed = names.len > 0;
+  while (changed) {
+    changed = false;
+
+    for (u32 i = 0; i < proc->instrs.len; ++i) {
+      IrInstr *instr = proc->instrs.items + i;
+      Str *dest = ir_instr_dest(instr);
+      if (!dest || instr->kind == IrInstrKindDeref ||
+          var_names_contain(&names, *dest))
+        continue;
+
+      for (u32 j = 0; j < names.len; ++j) {
+        if (ir_instr_uses_var(instr, names.items[j])) {
+          DA_APPEND(names, *dest);
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  return names;
+}
+
+static bool ir_call_passes_any(IrInstr *instr, VarNames *names) {
+  IrArgs *args = &instr->as.call.args;
+  for (u32 i = 0; i < args->len; ++i)
+    if (args->items[i].kind == IrArgKindVar &&
+        var_names_contain(names, args->items[i].as.var))
+      return true;
+
+  return false;
+}
+
+// Self tail calls reuse the frame: arguments are assigned to the
+// parameters and control jumps back to the beginning of the procedure,
+// right after the frame objects are allocated. A call that passes a
+// frame object is kept, since the next iteration would overwrite it
+static void eliminate_tail_calls(Optimizer *optimizer, IrProc *proc) {
+  Str entry_label_name = {0};
+  IrInstrs new_instrs = {0};
+  VarNames frame_pointers = ir_proc_frame_pointers(proc);
+
+  u32 frame_allocs_count = 0;
+  while (frame_allocs_count < proc->instrs.len &&
+         ir_instr_is_frame_alloc(proc->instrs.items + frame_allocs_count))
+    ++frame_allocs_count;
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    u32 tail_call_len = ir_proc_self_tail_call_len(proc, i);
+    if (tail_call_len > 0 &&
+        ir_call_passes_any(proc->instrs.items + i, &frame_pointers))
+      tail_call_len = 0;
+
+    if (tail_call_len == 0) {
+      DA_APPEND(new_instrs, proc->instrs.items[i]);
+      continue;
+    }
+
+    if (entry_label_name.len == 0)
+      entry_label_name = str_with_suffix(STR_LIT("tail_entry"), "",
+                                         optimizer->labels_count++);
+
+    IrArgs *args = &proc->instrs.items[i].as.call.args;
+    Str *temps = calloc(args->len, sizeof(Str));
+
+    // Arguments that read parameters are saved first, so that they see
+    // the values from before the reassignment
+    for (u32 j = 0; j < args->len; ++j) {
+      IrArg *arg = args->items + j;
+      if (arg->kind != IrArgKindVar ||
+          str_eq(arg->as.var, proc->params.items[j].name) ||
+          !ir_proc_has_param(proc, arg->as.var))
+        continue;
+
+      temps[j] = optimizer_new_tmp_var(optimizer);
+      IrInstr save = { IrInstrKindAssign, { .assign = { temps[j], *arg } } };
+      DA_APPEND(new_instrs, save);
+    }
+
+    for (u32 j = 0; j < args->len; ++j) {
+      IrArg arg = args->items[j];
+      Str param_name = proc->params.items[j].name;
+
+      if (temps[j].len > 0)
+        arg = (IrArg) { IrArgKindVar, { .var = temps[j] } };
+      else if (ir_arg_is_var(&arg, param_name))
+        continue;
+
+      IrInstr assign = { IrInstrKindAssign, { .assign = { param_name, arg } } };
+      DA_APPEND(new_instrs, assign);
+    }
+
+    free(temps);
+
+    IrInstr jump = { IrInstrKindJump, { .jump = { entry_label_name } } };
+    DA_APPEND(new_instrs, jump);
+
+    i += tail_call_len - 1;
+  }
+
+  free(frame_pointers.items);
+
+  if (entry_label_name.len == 0)
+    return;
+
+  IrInstrs instrs = {0};
+  for (u32 i = 0; i < frame_allocs_count; ++i)
+    DA_APPEND(instrs, new_instrs.items[i]);
+
+  IrInstr entry_label = { IrInstrKindLabel, { .label = { entry_label_name } } };
+  DA_APPEND(instrs, entry_label);
+
+  for (u32 i = frame_allocs_count; i < new_instrs.len; ++i)
+    DA_APPEND(instrs, new_instrs.items[i]);
+
+  proc->instrs = instrs;
+}
+
+// Resolves `arg` to a constant if it is a literal or a local that is
+// assigned a literal exactly once, before `index`
+static bool ir_proc_resolve_const(Ir *ir, IrProc *proc, IrArg *arg,
+                                  u32 index, i64 *value) {
+  if (arg->kind == IrArgKindValue)
+    return ir_type_is_signed_int(arg->as.value.type) &&
+           ir_arg_get_const(arg, value);
+
+  Str name = arg->as.var;
+  if (ir_is_static_var(ir, name) ||
+      ir_proc_has_param(proc, name) ||
+      ir_proc_var_is_address_taken(proc, name))
+    return false;
+
+  IrArg *def_arg = NULL;
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+
+    if (instr->kind == IrInstrKindCreate || !ir_instr_defines_var(instr, name))
+      continue;
+
+    if (def_arg || i >= index || instr->kind != IrInstrKindAssign)
+      return false;
+
+    def_arg = &instr->as.assign.arg;
+  }
+
+  return def_arg && def_arg->kind == IrArgKindValue &&
+         ir_type_is_signed_int(def_arg->as.value.type) &&
+         ir_arg_get_const(def_arg, value);
+}
+
+static bool fold_const_call(Ir *ir, IrProc *proc, u32 index) {
+  IrInstrCall *call = &proc->instrs.items[index].as.call;
+  if (call->dest.len == 0)
+    return false;
+
+  IrProc *callee = ir_find_proc(ir, call->callee_name, call->args.len);
+  if (!callee)
+    return false;
+
+  i64 *args = malloc(call->args.len * sizeof(i64));
+  bool is_const = true;
+  for (u32 i = 0; i < call->args.len && is_const; ++i)
+    is_const = ir_proc_resolve_const(ir, proc, call->args.items + i, index, args + i);
+
+  i64 result;
+  bool is_folded = is_const && ir_eval_call(ir, callee, args, &result);
+
+  free(args);
+
+  if (!is_folded)
+    return false;
+
+  IrArg arg = {
+    IrArgKindValue,
+    { .value = ir_arg_value_new(callee->ret_val_type, result) },
+  };
+  IrInstr assign = { IrInstrKindAssign, { .assign = { call->dest, arg } } };
+  proc->instrs.items[index] = assign;
+
+  return true;
+}
+
+// Calls to pure procedures with constant arguments are evaluated at
+// compile time. Folded results may make more arguments constant, so
+// this is repeated until nothing changes
+static void fold_const_calls(Ir *ir, IrProc *proc) {
+  bool is_changed = true;
+
+  while (is_changed) {
+    is_changed = false;
+
+    for (u32 i = 0; i < proc->instrs.len; ++i)
+      if (proc->instrs.items[i].kind == IrInstrKindCall &&
+          fold_const_call(ir, proc, i))
+        is_changed = true;
+  }
+}
+
+#define FRAME_OBJECT_ALIGNMENT 16
+#define FRAME_OBJECT_MAX_SIZE  4096
+
+typedef struct {
+  i64   offset;
+  Type *type;
+  Str   var_name;
+} ScalarField;
+
+typedef Da(ScalarField) ScalarFields;
+
+// Frame objects are allocated once at the entry of the procedure, so an
+// allocation inside of a loop does not grow the stack. The frame is
+// released together with rbp on return
+static void ir_proc_alloc_frame_object(IrProc *proc, Str name, i64 size) {
+  size = (size + FRAME_OBJECT_ALIGNMENT - 1) / FRAME_OBJECT_ALIGNMENT *
+         FRAME_OBJECT_ALIGNMENT;
+
+  StringBuilder sb = {0};
+  sb_push(&sb, "sub rsp,");
+  sb_push_u32(&sb, size);
+  sb_push(&sb, "\n  mov @@r,rsp");
+
+  IrInstr instr = {
+    IrInstrKindAsm,
+    { ._asm = { name, &s64_type, sb_to_str(sb), (VarNames) {0} } },
+  };
+
+  DA_APPEND(proc->instrs, instr);
+  memmove(proc->instrs.items + 1, proc->instrs.items,
+          (proc->instrs.len - 1) * sizeof(IrInstr));
+  proc->instrs.items[0] = instr;
+
+  // The allocation would be repeated at every call site otherwise
+  proc->is_noinline = true;
+}
+
+static bool ir_instr_is_malloc(IrInstr *instr, i64 *size) {
+  return instr->kind == IrInstrKindCall &&
+         str_eq(instr->as.call.callee_name, STR_LIT("malloc")) &&
+         instr->as.call.args.len == 1 &&
+         instr->as.call.dest.len > 0 &&
+         ir_arg_get_const(instr->as.call.args.items, size);
+}
+
+// Adds a field access to `fields`. Returns false if it overlaps another
+// field or uses a different type at the same offset
+static bool scalar_fields_add(ScalarFields *fields, i64 offset, Type *type) {
+  u32 size = type_kinds_sizes_table[type->kind];
+
+  for (u32 i = 0; i < fields->len; ++i) {
+    ScalarField *field = fields->items + i;
+    u32 field_size = type_kinds_sizes_table[field->type->kind];
+
+    if (field->offset == offset)
+      return field->type->kind == type->kind;
+
+    if (offset < field->offset + field_size && field->offset < offset + size)
+      return false;
+  }
+
+  ScalarField field = { offset, type, {0} };
+  DA_APPEND(*fields, field);
+
+  return true;
+}
+
+static ScalarField *scalar_fields_find(ScalarFields *fields, i64 offset) {
+  for (u32 i = 0; i < fields->len; ++i)
+    if (fields->items[i].offset == offset)
+      return fields->items + i;
+
+  return NULL;
+}
+
+// Returns false if the object that `name` points to may be reachable
+// from outside of the procedure. Otherwise collects the accessed fields
+// and whether the object can be split into scalars
+static bool ir_proc_object_escapes(Ir *ir, IrProc *proc, Str name, u32 def,
+                                   ScalarFields *fields, bool *is_splittable) {
+  if (ir_is_static_var(ir, name) ||
+      ir_proc_has_param(proc, name) ||
+      ir_proc_var_is_address_taken(proc, name))
+    return true;
+
+  *is_splittable = true;
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+
+    if (i == def || !ir_instr_refers_var(instr, name))
+      continue;
+
+    switch (instr->kind) {
+    case IrInstrKindPreAssignOp: {
+      IrInstrPreAssignOp *store = &instr->as.pre_assign_op;
+      if (!str_eq(store->dest, name) || !str_eq(store->op, STR_LIT("*")) ||
+          ir_arg_is_var(&store->arg, name))
+        return true;
+
+      Type *type = store->type ? store->type : &s64_type;
+      if (store->is_indexed) {
+        if (ir_arg_is_var(&store->index, name))
+          return true;
+        *is_splittable = false;
+      } else if (!scalar_fields_add(fields, store->offset, type)) {
+        *is_splittable = false;
+      }
+    } break;
+
+    case IrInstrKindDeref: {
+      IrInstrDeref *load = &instr->as.deref;
+      if (str_eq(load->dest, name) || !ir_arg_is_var(&load->arg, name))
+        return true;
+
+      if (load->is_indexed) {
+        if (ir_arg_is_var(&load->index, name))
+          return true;
+        *is_splittable = false;
+      } else if (!scalar_fields_add(fields, load->offset, load->type)) {
+        *is_splittable = false;
+      }
+    } break;
+
+    // Comparing the pointer does not leak it, but needs its value
+    case IrInstrKindIf:
+    case IrInstrKindWhile: {
+      *is_splittable = false;
+    } break;
+
+    default: return true;
+    }
+  }
+
+  return false;
+}
+
+static void split_object(Optimizer *optimizer, IrProc *proc, Str name,
+                         u32 def, ScalarFields *fields) {
+  for (u32 i = 0; i < fields->len; ++i)
+    fields->items[i].var_name = optimizer_new_tmp_var(optimizer);
+
+  IrInstrs new_instrs = {0};
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+
+    // malloc does not zero memory and neither does a frame object. The
+    // fields are set to zero only so that every one of them is defined
+    if (i == def) {
+      for (u32 j = 0; j < fields->len; ++j) {
+        ScalarField *field = fields->items + j;
+        IrArg zero = { IrArgKindValue, { .value = ir_arg_value_new(field->type, 0) } };
+        IrInstr init = { IrInstrKindAssign, { .assign = { field->var_name, zero } } };
+        DA_APPEND(new_instrs, init);
+      }
+
+      continue;
+    }
+
+    if (instr->kind == IrInstrKindPreAssignOp &&
+        str_eq(instr->as.pre_assign_op.dest, name)) {
+      IrInstrPreAssignOp *store = &instr->as.pre_assign_op;
+      ScalarField *field = scalar_fields_find(fields, store->offset);
+      i64 value;
+
+      if (ir_arg_get_const(&store->arg, &value)) {
+        IrArg arg = { IrArgKindValue, { .value = ir_arg_value_new(field->type, value) } };
+        IrInstr assign = { IrInstrKindAssign, { .assign = { field->var_name, arg } } };
+        DA_APPEND(new_instrs, assign);
+      } else {
+        IrInstr cast = { IrInstrKindCast, { .cast = { field->var_name, field->type, store->arg } } };
+        DA_APPEND(new_instrs, cast);
+      }
+
+      continue;
+    }
+
+    if (instr->kind == IrInstrKindDeref &&
+        ir_arg_is_var(&instr->as.deref.arg, name)) {
+      IrInstrDeref *load = &instr->as.deref;
+      ScalarField *field = scalar_fields_find(fields, load->offset);
+      IrArg arg = { IrArgKindVar, { .var = field->var_name } };
+      IrInstr assign = { IrInstrKindAssign, { .assign = { load->dest, arg } } };
+      DA_APPEND(new_instrs, assign);
+      continue;
+    }
+
+    DA_APPEND(new_instrs, *instr);
+  }
+
+  proc->instrs = new_instrs;
+}
+
+static bool stack_allocate_one(Optimizer *optimizer, IrProc *proc) {
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+    i64 size;
+
+    if (!ir_instr_is_malloc(instr, &size) || size <= 0)
+      continue;
+
+    Str name = instr->as.call.dest;
+
+    bool has_single_def = true;
+    for (u32 j = 0; j < proc->instrs.len && has_single_def; ++j)
+      if (j != i && ir_instr_defines_var(proc->instrs.items + j, name))
+        has_single_def = false;
+
+    ScalarFields fields = {0};
+    bool is_splittable;
+
+    if (!has_single_def ||
+        ir_proc_object_escapes(optimizer->ir, proc, name, i, &fields, &is_splittable))
+      continue;
+
+    if (is_splittable) {
+      split_object(optimizer, proc, name, i, &fields);
+      return true;
+    }
+
+    // Inline procedures are expanded by mvm, so their frame is not theirs
+    if (proc->is_inlined || size > FRAME_OBJECT_MAX_SIZE)
+      continue;
+
+    memmove(proc->instrs.items + i, proc->instrs.items + i + 1,
+            (proc->instrs.len - i - 1) * sizeof(IrInstr));
+    --proc->instrs.len;
+    ir_proc_alloc_frame_object(proc, name, size);
+
+    return true;
+  }
+
+  return false;
+}
+
+// Objects from `malloc` that never leave the procedure are split into
+// scalars if they are only accessed by constant offsets, and are placed
+// in the stack frame otherwise
+static void stack_allocate_objects(Optimizer *optimizer, IrProc *proc) {
+  while (stack_allocate_one(optimizer, proc));
+}
+
+// Local arrays live in the frame for the whole call
+static void allocate_local_arrays(IrProc *proc) {
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+
+    if (instr->kind != IrInstrKindCreate ||
+        instr->as.create.dest_type->array_len == 0)
+      continue;
+
+    Str name = instr->as.create.dest;
+    Type *type = instr->as.create.dest_type;
+
+    if (proc->is_naked || proc->is_inlined) {
+      ERROR("Local array `"STR_FMT"` can not be declared in naked or inline procedure `"STR_FMT"`\n",
+            STR_ARG(name), STR_ARG(proc->name));
+      exit(1);
+    }
+
+    memmove(proc->instrs.items + i, proc->instrs.items + i + 1,
+            (proc->instrs.len - i - 1) * sizeof(IrInstr));
+    --proc->instrs.len;
+
+    i64 size = (i64) type->array_len * type_kinds_sizes_table[type->ptr_target->kind];
+    ir_proc_alloc_frame_object(proc, name, size);
+  }
+}
+
+static bool ir_proc_reaches(Ir *ir, IrProc *from, IrProc *target, bool *visited) {
+  u32 index = from - ir->procs.items;
+  if (visited[index])
+    return false;
+  visited[index] = true;
+
+  for (u32 i = 0; i < from->instrs.len; ++i) {
+    IrInstr *instr = from->instrs.items + i;
+    if (instr->kind != IrInstrKindCall)
+      continue;
+
+    IrProc *callee = ir_find_proc(ir, instr->as.call.callee_name,
+                                  instr->as.call.args.len);
+    if (!callee)
+      continue;
+
+    if (callee == target || ir_proc_reaches(ir, callee, target, visited))
+      return true;
+  }
+
+  return false;
+}
+
+static bool ir_proc_is_recursive(Ir *ir, IrProc *proc) {
+  bool *visited = calloc(ir->procs.len, sizeof(bool));
+  bool result = ir_proc_reaches(ir, proc, proc, visited);
+  free(visited);
+
+  return result;
+}
+
+// Assembly without variable placeholders works with the registers of
+// the calling convention directly, so it only makes sense in a real call
+static bool ir_proc_depends_on_abi(IrProc *proc) {
+  if (proc->is_naked)
+    return true;
+
+  for (u32 i = 0; i < proc->instrs.len; ++i) {
+    IrInstr *instr = proc->instrs.items + i;
+    if (instr->kind != IrInstrKindAsm)
+      continue;
+
+    Str code = instr->as._asm.code;
+    bool has_placeholders = false;
+
+    for (u32 j = 0; j < code.len; ++j) {
+      if (code.ptr[j] == '@') {
+        has_placeholders = true;
+        break;
+      }
+    }
+
+    if (!has_placeholders)
+      return true;
+  }
+
+  return false;
+}
+
+static u32 ir_count_call_sites(Ir *ir, IrProc *callee) {
+  u32 count = 0;
+
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+
+    for (u32 j = 0; j < proc->instrs.len; ++j) {
+      IrInstr *instr = proc->instrs.items + j;
+
+      if (instr->kind == IrInstrKindCall &&
+          str_eq(instr->as.call.callee_name, callee->name) &&
+          instr->as.call.args.len == callee->params.len)
+        ++count;
+    }
+  }
+
+  return count;
+}
+
+// Small procedures and procedures with a single caller are inlined by
+// default, the cost is measured in IR instructions
+static void mark_procs_for_inlining(Ir *ir) {
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+
+    if (proc->is_inlined || proc->is_noinline ||
+        str_eq(proc->name, STR_LIT("main")))
+      continue;
+
+    u32 call_sites_count = ir_count_call_sites(ir, proc);
+    if (call_sites_count == 0)
+      continue;
+
+    u32 cost = proc->instrs.len;
+    if (cost > AUTO_INLINE_MAX_INSTRS_COUNT &&
+        (call_sites_count > 1 || cost > AUTO_INLINE_SINGLE_CALLER_MAX_INSTRS_COUNT))
+      continue;
+
+    if (ir_proc_depends_on_abi(proc) || ir_proc_is_recursive(ir, proc))
+      continue;
+
+    // Labels would be duplicated at every call site
+    bool has_labels = false;
+    for (u32 j = 0; j < proc->instrs.len; ++j) {
+      IrInstrKind kind = proc->instrs.items[j].kind;
+      if (kind == IrInstrKindLabel || kind == IrInstrKindWhile)
+        has_labels = true;
+    }
+
+    if (has_labels)
+      continue;
+
+    proc->is_inlined = true;
+  }
+}
+
+void optimize_ir(Ir *ir) {
+  Optimizer optimizer = {0};
+  optimizer.ir = ir;
+
+  propagate_static_consts(ir);
+  insert_exit_hooks(ir);
+
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+
+    fold_const_ifs(proc);
+    allocate_local_arrays(proc);
+
+    if (!proc->is_naked) {
+      fold_const_calls(ir, proc);
+      eliminate_tail_calls(&optimizer, proc);
+      stack_allocate_objects(&optimizer, proc);
+      hoist_loop_invariants(ir, proc);
+      unroll_loops(&optimizer, proc);
+      coalesce_bin_op_dests(ir, proc);
+    }
+
+    // Naked procedures can store variables too
+    cast_narrow_stores(&optimizer, proc);
+  }
+
+  mark_procs_for_inlining(ir);
+}
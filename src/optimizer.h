@@ -0,0 +1,8 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ir.h"
+
+void optimize_ir(Ir *ir);
+
+#endif // OPTIMIZER_H
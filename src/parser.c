@@ -6,7 +6,7 @@
 #include "lexgen/runtime.h"
 #include "../grammar.h"
 #include "ir.h"
-#include "ir_to_mvm.h"
+#include "analysis.h"
 #include "shl/shl-log.h"
 #include "shl/shl-arena.h"
 
@@ -39,13 +39,42 @@ typedef struct {
 typedef Da(ParserStaticVariable) ParserStaticVariables;
 
 typedef struct {
-  Str  name;
-  u8  *data;
-  u32  size;
+  Str   name;
+  u8   *data;
+  u32   size;
+  bool  is_str_lit;
 } ParserStaticBuffer;
 
 typedef Da(ParserStaticBuffer) ParserStaticData;
 
+typedef Da(u8) Bytes;
+
+typedef struct {
+  Str   name;
+  Type *type;
+  u32   offset;
+} RecordField;
+
+typedef Da(RecordField) RecordFields;
+
+typedef struct {
+  Str          name;
+  RecordFields fields;
+  u32          size;
+  u32          alignment;
+  bool         is_packed;
+} Record;
+
+typedef Da(Record) Records;
+
+typedef struct {
+  Str   name;
+  u32   params_count;
+  Type *ret_val_type;
+} ProcSignature;
+
+typedef Da(ProcSignature) ProcSignatures;
+
 typedef struct {
   Tokens                *tokens;
   u32                    index;
@@ -53,6 +82,11 @@ typedef struct {
   ParserStaticVariables  static_vars;
   ParserStaticData       static_data;
   u32                    max_labels_count;
+  Records                records;
+  // Procedures that return records
+  ProcSignatures         record_procs;
+  // Types of the variables of the current procedure
+  Vars                   vars;
 } Parser;
 
 static Str token_id_names[] = {
@@ -78,6 +112,12 @@ static Str token_id_names[] = {
   STR_LIT("`cast`"),
   STR_LIT("`record`"),
   STR_LIT("`inline`"),
+  STR_LIT("`unroll`"),
+  STR_LIT("`noinline`"),
+  STR_LIT("`packed`"),
+  STR_LIT("`sizeof`"),
+  STR_LIT("`offsetof`"),
+  STR_LIT("`lenof`"),
   STR_LIT("identifier"),
   STR_LIT("number"),
   STR_LIT("`(`"),
@@ -85,6 +125,7 @@ static Str token_id_names[] = {
   STR_LIT("`[`"),
   STR_LIT("`]`"),
   STR_LIT("`,`"),
+  STR_LIT("`.`"),
   STR_LIT("`:`"),
   STR_LIT("`==`"),
   STR_LIT("`!=`"),
@@ -100,7 +141,8 @@ static Str token_id_names[] = {
   STR_LIT("operator"),
 };
 
-static Type unit_type = { TypeKindUnit, NULL };
+static Type unit_type = { TypeKindUnit, NULL, {0}, 0 };
+static Type s64_type = { TypeKindS64, NULL, {0}, 0 };
 
 static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs);
 static bool parser_parse_global_instr(Parser *parser, Ir *ir,
@@ -309,6 +351,8 @@ static Type *parser_parse_type(Parser *parser) {
   if (token->id == TT_IDENT) {
     type->kind = str_to_type_kind(token->lexeme);
     type->ptr_target = NULL;
+    if (type->kind == TypeKindPtr)
+      type->record_name = token->lexeme;
   } else if (token->id == TT_REF) {
     type->kind = TypeKindPtr;
     type->ptr_target = parser_parse_type(parser);
@@ -317,6 +361,210 @@ static Type *parser_parse_type(Parser *parser) {
   return type;
 }
 
+static Record *parser_find_record(Parser *parser, Str name) {
+  for (u32 i = 0; i < parser->records.len; ++i)
+    if (str_eq(parser->records.items[i].name, name))
+      return parser->records.items + i;
+
+  return NULL;
+}
+
+static Record *parser_expect_record(Parser *parser, Token *name_token) {
+  Record *record = parser_find_record(parser, name_token->lexeme);
+  if (!record) {
+    ERROR(STR_FMT":%u:%u: Unknown record: `"STR_FMT"`\n",
+          STR_ARG(name_token->file_path), name_token->row + 1,
+          name_token->col + 1, STR_ARG(name_token->lexeme));
+    exit(1);
+  }
+
+  return record;
+}
+
+static RecordField *parser_expect_record_field(Parser *parser, Record *record) {
+  Token *field_token = parser_expect_token(parser, MASK(TT_IDENT));
+
+  for (u32 i = 0; i < record->fields.len; ++i)
+    if (str_eq(record->fields.items[i].name, field_token->lexeme))
+      return record->fields.items + i;
+
+  ERROR(STR_FMT":%u:%u: Record `"STR_FMT"` has no field `"STR_FMT"`\n",
+        STR_ARG(field_token->file_path), field_token->row + 1,
+        field_token->col + 1, STR_ARG(record->name),
+        STR_ARG(field_token->lexeme));
+  exit(1);
+}
+
+static void parser_set_var_type(Parser *parser, Str name, Type *type) {
+  for (u32 i = 0; i < parser->vars.len; ++i) {
+    if (str_eq(parser->vars.items[i].name, name)) {
+      parser->vars.items[i].type = type;
+      return;
+    }
+  }
+
+  Var var = { name, type };
+  DA_APPEND(parser->vars, var);
+}
+
+static Type *parser_get_var_type(Parser *parser, Str name) {
+  for (u32 i = 0; i < parser->vars.len; ++i)
+    if (str_eq(parser->vars.items[i].name, name))
+      return parser->vars.items[i].type;
+
+  return NULL;
+}
+
+static Record *parser_expect_var_record(Parser *parser, Token *var_token) {
+  Type *type = parser_get_var_type(parser, var_token->lexeme);
+  if (!type || type->record_name.len == 0) {
+    ERROR(STR_FMT":%u:%u: `"STR_FMT"` is not known to be a record\n",
+          STR_ARG(var_token->file_path), var_token->row + 1,
+          var_token->col + 1, STR_ARG(var_token->lexeme));
+    exit(1);
+  }
+
+  Record *record = parser_find_record(parser, type->record_name);
+  if (!record) {
+    ERROR(STR_FMT":%u:%u: Unknown record: `"STR_FMT"`\n",
+          STR_ARG(var_token->file_path), var_token->row + 1,
+          var_token->col + 1, STR_ARG(type->record_name));
+    exit(1);
+  }
+
+  return record;
+}
+
+static u32 parser_type_size(Parser *parser, Type *type, Token *token) {
+  if (type->record_name.len > 0)
+    return parser_expect_record(parser, token)->size;
+
+  return type_kinds_sizes_table[type->kind];
+}
+
+// Fields are aligned to their size, unless the record is packed.
+// Record fields are pointers, so layouts do not depend on each other
+static void record_compute_layout(Record *record) {
+  u32 offset = 0;
+  record->alignment = 1;
+
+  for (u32 i = 0; i < record->fields.len; ++i) {
+    RecordField *field = record->fields.items + i;
+    u32 size = type_kinds_sizes_table[field->type->kind];
+
+    if (size == 0) {
+      ERROR("Field `"STR_FMT"` of record `"STR_FMT"` can not be of unit type\n",
+            STR_ARG(field->name), STR_ARG(record->name));
+      exit(1);
+    }
+
+    if (!record->is_packed) {
+      offset = (offset + size - 1) / size * size;
+      if (size > record->alignment)
+        record->alignment = size;
+    }
+
+    field->offset = offset;
+    offset += size;
+  }
+
+  if (!record->is_packed)
+    offset = (offset + record->alignment - 1) / record->alignment * record->alignment;
+
+  record->size = offset;
+}
+
+// record [packed] NAME:
+//   field: T,
+//   ...
+// end
+static void parser_parse_record_def(Parser *parser) {
+  Record record = {0};
+
+  Token *token = parser_expect_token(parser, MASK(TT_IDENT) | MASK(TT_PACKED));
+  if (token->id == TT_PACKED) {
+    record.is_packed = true;
+    token = parser_expect_token(parser, MASK(TT_IDENT));
+  }
+
+  record.name = token->lexeme;
+
+  if (parser_find_record(parser, record.name)) {
+    ERROR(STR_FMT":%u:%u: Record `"STR_FMT"` is already defined\n",
+          STR_ARG(token->file_path), token->row + 1,
+          token->col + 1, STR_ARG(record.name));
+    exit(1);
+  }
+
+  parser_expect_token(parser, MASK(TT_COLON));
+
+  token = parser_peek_token(parser, 0);
+  while (token && token->id != TT_END) {
+    Token *field_name_token = parser_expect_token(parser, MASK(TT_IDENT));
+    parser_expect_token(parser, MASK(TT_COLON));
+    Type *field_type = parser_parse_type(parser);
+    RecordField field = { field_name_token->lexeme, field_type, 0 };
+    DA_APPEND(record.fields, field);
+
+    token = parser_peek_token(parser, 0);
+    if (token && token->id == TT_COMMA) {
+      parser_next_token(parser);
+      token = parser_peek_token(parser, 0);
+    }
+  }
+
+  parser_expect_token(parser, MASK(TT_END));
+
+  record_compute_layout(&record);
+  DA_APPEND(parser->records, record);
+}
+
+// Records can be used before they are defined, so they are collected
+// before anything else is parsed
+static void parser_collect_records(Parser *parser) {
+  for (u32 i = 0; i < parser->tokens->len; ++i) {
+    if (parser->tokens->items[i].id != TT_RECORD)
+      continue;
+
+    parser->index = i + 1;
+    parser_parse_record_def(parser);
+    i = parser->index - 1;
+  }
+
+  parser->index = 0;
+}
+
+static IrArg ir_arg_new_s64(i64 value) {
+  return (IrArg) {
+    IrArgKindValue,
+    { .value = { &s64_type, { ._s64 = value } } },
+  };
+}
+
+// [N]T
+static Type *parser_parse_array_type(Parser *parser) {
+  parser_expect_token(parser, MASK(TT_OBRACKET));
+  Token *len_token = parser_expect_token(parser, MASK(TT_NUMBER));
+  IrArg len = token_to_ir_arg(len_token, IrArgKindValue);
+  parser_expect_token(parser, MASK(TT_CBRACKET));
+
+  i64 array_len;
+  if (!ir_arg_get_const(&len, &array_len) || array_len <= 0) {
+    ERROR(STR_FMT":%u:%u: Array length should be a positive number\n",
+          STR_ARG(len_token->file_path), len_token->row + 1,
+          len_token->col + 1);
+    exit(1);
+  }
+
+  Type *type = aalloc(sizeof(Type));
+  *type = (Type) {0};
+  type->kind = TypeKindPtr;
+  type->ptr_target = parser_parse_type(parser);
+  type->array_len = array_len;
+
+  return type;
+}
+
 static Str create_static_var_name(u32 id) {
   StringBuilder sb = {0};
   sb_push(&sb, "?s");
@@ -325,9 +573,36 @@ static Str create_static_var_name(u32 id) {
   return sb_to_str(sb);
 }
 
+// Identical literals share one buffer
+static Str parser_intern_str_lit(Parser *parser, Str lexeme) {
+  for (u32 i = 0; i < parser->static_data.len; ++i) {
+    ParserStaticBuffer *buffer = parser->static_data.items + i;
+
+    if (buffer->is_str_lit && buffer->size == lexeme.len + 1 &&
+        memcmp(buffer->data, lexeme.ptr, lexeme.len) == 0)
+      return buffer->name;
+  }
+
+  Str buffer_name = create_static_var_name(parser->static_data.len);
+  u8 *data = malloc(lexeme.len + 1);
+  memcpy(data, lexeme.ptr, lexeme.len);
+  data[lexeme.len] = '\0';
+  ParserStaticBuffer buffer = {
+    buffer_name,
+    data,
+    lexeme.len + 1,
+    true,
+  };
+  DA_APPEND(parser->static_data, buffer);
+
+  return buffer_name;
+}
+
 static IrArg parser_parse_arg(Parser *parser) {
   Token *token = parser_expect_token(parser, MASK(TT_NUMBER) | MASK(TT_IDENT) |
-                                             MASK(TT_STR_LIT) | MASK(TT_CHAR_LIT));
+                                             MASK(TT_STR_LIT) | MASK(TT_CHAR_LIT) |
+                                             MASK(TT_SIZEOF) | MASK(TT_OFFSETOF) |
+                                             MASK(TT_LENOF));
   IrArg arg;
 
   if (token->id == TT_NUMBER || token->id == TT_CHAR_LIT) {
@@ -335,16 +610,7 @@ static IrArg parser_parse_arg(Parser *parser) {
   } else if (token->id == TT_IDENT) {
     arg = token_to_ir_arg(token, IrArgKindVar);
   } else if (token->id == TT_STR_LIT) {
-    Str buffer_name = create_static_var_name(parser->static_data.len);
-    u8 *data = malloc(token->lexeme.len + 1);
-    memcpy(data, token->lexeme.ptr, token->lexeme.len);
-    data[token->lexeme.len] = '\0';
-    ParserStaticBuffer buffer = {
-      buffer_name,
-      data,
-      token->lexeme.len + 1,
-    };
-    DA_APPEND(parser->static_data, buffer);
+    Str buffer_name = parser_intern_str_lit(parser, token->lexeme);
 
     Token str_token = {
       buffer_name,
@@ -355,26 +621,127 @@ static IrArg parser_parse_arg(Parser *parser) {
     };
 
     arg = token_to_ir_arg(&str_token, IrArgKindVar);
+  } else if (token->id == TT_SIZEOF) {
+    Token *type_token = parser_peek_token(parser, 0);
+    Type *type = parser_parse_type(parser);
+    arg = ir_arg_new_s64(parser_type_size(parser, type, type_token));
+  } else if (token->id == TT_OFFSETOF) {
+    Token *record_token = parser_expect_token(parser, MASK(TT_IDENT));
+    Record *record = parser_expect_record(parser, record_token);
+    parser_expect_token(parser, MASK(TT_DOT));
+    arg = ir_arg_new_s64(parser_expect_record_field(parser, record)->offset);
+  } else if (token->id == TT_LENOF) {
+    // The static buffer of a literal is its lexeme plus the terminator
+    Token *str_token = parser_expect_token(parser, MASK(TT_STR_LIT));
+    arg = ir_arg_new_s64(str_token->lexeme.len);
   }
 
   return arg;
 }
 
+// [index], [index + disp] or [index - disp], the opening bracket is already consumed
+// The displacement counts elements, like the index, and is returned
+// in bytes
+static void parser_parse_index(Parser *parser, IrArg *index, i64 *offset,
+                               Type *type) {
+  *index = parser_parse_arg(parser);
+  *offset = 0;
+
+  Token *next = parser_peek_token(parser, 0);
+  bool is_negative = false;
+
+  if (next && next->id == TT_OP &&
+      (str_eq(next->lexeme, STR_LIT("+")) || str_eq(next->lexeme, STR_LIT("-")))) {
+    parser_next_token(parser);
+    is_negative = str_eq(next->lexeme, STR_LIT("-"));
+  } else if (!next || next->id != TT_NUMBER) {
+    parser_expect_token(parser, MASK(TT_CBRACKET));
+    return;
+  }
+
+  // `i-4` is lexed as an identifier followed by a negative number
+  Token *disp_token = parser_expect_token(parser, MASK(TT_NUMBER));
+  IrArg disp = token_to_ir_arg(disp_token, IrArgKindValue);
+  if (!ir_arg_get_const(&disp, offset)) {
+    ERROR(STR_FMT":%u:%u: Displacement should be an integer\n",
+          STR_ARG(disp_token->file_path), disp_token->row + 1,
+          disp_token->col + 1);
+    exit(1);
+  }
+
+  if (is_negative)
+    *offset = -*offset;
+  *offset *= type_kinds_sizes_table[type->kind];
+
+  parser_expect_token(parser, MASK(TT_CBRACKET));
+}
+
+#define STATIC_ARRAY_ALIGNMENT 8
+
+// static NAME: T = [value, ...]
+static void parser_parse_static_array(Parser *parser, Str name) {
+  Type *type = parser_parse_type(parser);
+  u32 element_size = type_kinds_sizes_table[type->kind];
+  if (element_size == 0) {
+    ERROR("Static array `"STR_FMT"` can not have elements of unit type\n",
+          STR_ARG(name));
+    exit(1);
+  }
+
+  parser_expect_token(parser, MASK(TT_ASSIGN));
+  parser_expect_token(parser, MASK(TT_OBRACKET));
+
+  Bytes data = {0};
+
+  Token *token = parser_peek_token(parser, 0);
+  while (token && token->id != TT_CBRACKET) {
+    IrArg arg = parser_parse_arg(parser);
+    i64 value;
+    if (!ir_arg_get_const(&arg, &value)) {
+      ERROR("Only values can be stored in static array `"STR_FMT"`\n",
+            STR_ARG(name));
+      exit(1);
+    }
+
+    for (u32 i = 0; i < element_size; ++i)
+      DA_APPEND(data, (u8) ((u64) value >> (i * 8)));
+
+    token = parser_peek_token(parser, 0);
+    if (token->id != TT_CBRACKET)
+      token = parser_expect_token(parser, MASK(TT_COMMA) | MASK(TT_CBRACKET));
+  }
+
+  parser_expect_token(parser, MASK(TT_CBRACKET));
+
+  // Arrays are laid out back to back, so padding keeps every one of
+  // them aligned to the first
+  while (data.len == 0 || data.len % STATIC_ARRAY_ALIGNMENT != 0)
+    DA_APPEND(data, 0);
+
+  ParserStaticBuffer buffer = { name, data.items, data.len, false };
+  DA_APPEND(parser->static_data, buffer);
+}
+
 static IrProc parser_parse_proc_def(Parser *parser) {
   IrProc proc = {0};
 
   Token *token = parser_expect_token(parser, MASK(TT_IDENT) |
                                              MASK(TT_NAKED) |
-                                             MASK(TT_INLINE));
+                                             MASK(TT_INLINE) |
+                                             MASK(TT_NOINLINE));
 
   if (token->id == TT_NAKED) {
     proc.is_naked = true;
-    token = parser_expect_token(parser, MASK(TT_IDENT) | MASK(TT_INLINE));
+    token = parser_expect_token(parser, MASK(TT_IDENT) | MASK(TT_INLINE) |
+                                        MASK(TT_NOINLINE));
   }
 
   if (token->id == TT_INLINE) {
     proc.is_inlined = true;
     token = parser_expect_token(parser, MASK(TT_IDENT));
+  } else if (token->id == TT_NOINLINE) {
+    proc.is_noinline = true;
+    token = parser_expect_token(parser, MASK(TT_IDENT));
   }
 
   proc.name = token->lexeme;
@@ -409,6 +776,40 @@ static IrProc parser_parse_proc_def(Parser *parser) {
   return proc;
 }
 
+// Results of calls are only known to be records if the signatures of
+// all procedures are collected before parsing the bodies
+static void parser_collect_record_procs(Parser *parser) {
+  for (u32 i = 0; i < parser->tokens->len; ++i) {
+    if (parser->tokens->items[i].id != TT_PROC)
+      continue;
+
+    parser->index = i + 1;
+    IrProc proc = parser_parse_proc_def(parser);
+    i = parser->index - 1;
+
+    if (proc.ret_val_type->record_name.len == 0)
+      continue;
+
+    ProcSignature signature = { proc.name, proc.params.len, proc.ret_val_type };
+    DA_APPEND(parser->record_procs, signature);
+  }
+
+  parser->index = 0;
+}
+
+static Type *parser_find_record_proc_ret_val_type(Parser *parser, Str name,
+                                                  u32 params_count) {
+  for (u32 i = 0; i < parser->record_procs.len; ++i) {
+    ProcSignature *signature = parser->record_procs.items + i;
+
+    if (str_eq(signature->name, name) &&
+        signature->params_count == params_count)
+      return signature->ret_val_type;
+  }
+
+  return NULL;
+}
+
 static IrInstr parser_parse_proc_call(Parser *parser, Str name, Str dest) {
   IrArgs args = {0};
 
@@ -474,6 +875,46 @@ static IrInstr parser_parse_asm(Parser *parser, Str dest, Type *dest_type) {
   };
 }
 
+// `$NAME(args)` allocates a record with `malloc` and stores the
+// arguments into its fields
+static void parser_parse_record_create(Parser *parser, Str dest, IrInstrs *instrs) {
+  Token *name_token = parser_expect_token(parser, MASK(TT_IDENT));
+  Record *record = parser_expect_record(parser, name_token);
+  parser_expect_token(parser, MASK(TT_OPAREN));
+
+  IrInstr fields_instr = parser_parse_proc_call(parser, name_token->lexeme, dest);
+  IrArgs *fields_args = &fields_instr.as.call.args;
+
+  if (fields_args->len != record->fields.len) {
+    ERROR(STR_FMT":%u:%u: Record `"STR_FMT"` has %u fields, but %u were given\n",
+          STR_ARG(name_token->file_path), name_token->row + 1,
+          name_token->col + 1, STR_ARG(record->name),
+          record->fields.len, fields_args->len);
+    exit(1);
+  }
+
+  IrArgs malloc_args = {0};
+  DA_APPEND(malloc_args, ir_arg_new_s64(record->size));
+  IrInstr malloc_instr = {
+    IrInstrKindCall,
+    { .call = { STR_LIT("malloc"), dest, malloc_args } },
+  };
+  DA_APPEND(*instrs, malloc_instr);
+
+  for (u32 i = 0; i < record->fields.len; ++i) {
+    RecordField *field = record->fields.items + i;
+    IrInstr instr = {
+      IrInstrKindPreAssignOp,
+      { .pre_assign_op = { dest, STR_LIT("*"), fields_args->items[i], field->type, field->offset } },
+    };
+    DA_APPEND(*instrs, instr);
+  }
+
+  Type *type = aalloc(sizeof(Type));
+  *type = (Type) { TypeKindPtr, NULL, record->name, 0 };
+  parser_set_var_type(parser, dest, type);
+}
+
 static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
   u32 recursion_level = 0;
 
@@ -488,21 +929,63 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
     switch (token->id) {
     case TT_IDENT: {
       Token *next = parser_expect_token(parser, MASK(TT_COLON) | MASK(TT_ASSIGN) |
-                                                MASK(TT_OPAREN));
+                                                MASK(TT_OPAREN) | MASK(TT_DOT));
 
       if (next->id == TT_COLON) {
-        Type *dest_type = parser_parse_type(parser);
+        Type *dest_type;
+        next = parser_peek_token(parser, 0);
+        if (next && next->id == TT_OBRACKET)
+          dest_type = parser_parse_array_type(parser);
+        else
+          dest_type = parser_parse_type(parser);
+
         IrInstr instr = { IrInstrKindCreate, { .create = { token->lexeme, dest_type } } };
         DA_APPEND(*instrs, instr);
+        parser_set_var_type(parser, token->lexeme, dest_type);
+      } else if (next->id == TT_DOT) {
+        Record *record = parser_expect_var_record(parser, token);
+        RecordField *field = parser_expect_record_field(parser, record);
+        parser_expect_token(parser, MASK(TT_ASSIGN));
+        IrArg arg = parser_parse_arg(parser);
+
+        IrInstr instr = {
+          IrInstrKindPreAssignOp,
+          { .pre_assign_op = { token->lexeme, STR_LIT("*"), arg, field->type, field->offset } },
+        };
+        DA_APPEND(*instrs, instr);
       } else if (next->id == TT_ASSIGN) {
         next = parser_peek_token(parser, 0);
-        if (next->id == TT_IDENT) {
+        Token *after_next = parser_peek_token(parser, 1);
+        if (next->id == TT_IDENT && after_next && after_next->id == TT_DOT) {
+          Token *var_token = parser_next_token(parser);
+          parser_next_token(parser);
+          Record *record = parser_expect_var_record(parser, var_token);
+          RecordField *field = parser_expect_record_field(parser, record);
+
+          IrArg arg = { IrArgKindVar, { .var = var_token->lexeme } };
+          IrInstr instr = {
+            IrInstrKindDeref,
+            { .deref = { token->lexeme, field->type, arg } },
+          };
+          instr.as.deref.offset = field->offset;
+          DA_APPEND(*instrs, instr);
+          parser_set_var_type(parser, token->lexeme, field->type);
+        } else if (next->id == TT_RECORD_CREATE) {
+          parser_next_token(parser);
+          parser_parse_record_create(parser, token->lexeme, instrs);
+        } else if (next->id == TT_IDENT) {
           next = parser_peek_token(parser, 1);
           if (next->id == TT_OPAREN) {
             Token *callee_name_token = parser_next_token(parser);
             parser_next_token(parser);
             IrInstr instr = parser_parse_proc_call(parser, callee_name_token->lexeme, token->lexeme);
             DA_APPEND(*instrs, instr);
+
+            Type *ret_val_type =
+              parser_find_record_proc_ret_val_type(parser, callee_name_token->lexeme,
+                                                   instr.as.call.args.len);
+            if (ret_val_type)
+              parser_set_var_type(parser, token->lexeme, ret_val_type);
           } else {
             IrArg arg0 = parser_parse_arg(parser);
 
@@ -520,6 +1003,10 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
             } else {
               IrInstr instr = { IrInstrKindAssign, { .assign = { token->lexeme, arg0 } } };
               DA_APPEND(*instrs, instr);
+
+              Type *type = parser_get_var_type(parser, arg0.as.var);
+              if (type)
+                parser_set_var_type(parser, token->lexeme, type);
             }
           }
         } else if (next->id == TT_ASM) {
@@ -545,6 +1032,7 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
             { .cast = { token->lexeme, type, arg } },
           };
           DA_APPEND(*instrs, instr);
+          parser_set_var_type(parser, token->lexeme, type);
         } else if (next->id == TT_DEREF) {
           parser_next_token(parser);
           Type *type = parser_parse_type(parser);
@@ -553,7 +1041,19 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
             IrInstrKindDeref,
             { .deref = { token->lexeme, type, arg } },
           };
+
+          // `*T ptr[index + disp]` loads the element at
+          // `ptr + (index + disp) * sizeof(T)`
+          next = parser_peek_token(parser, 0);
+          if (next && next->id == TT_OBRACKET) {
+            parser_next_token(parser);
+            instr.as.deref.is_indexed = true;
+            parser_parse_index(parser, &instr.as.deref.index,
+                               &instr.as.deref.offset, type);
+          }
+
           DA_APPEND(*instrs, instr);
+          parser_set_var_type(parser, token->lexeme, type);
         } else {
           IrArg arg0 = parser_parse_arg(parser);
 
@@ -586,6 +1086,25 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
       RelOp rel_op = parser_parse_rel_op(parser);
       IrArg arg1 = parser_parse_arg(parser);
 
+      // 0 lets the optimizer decide
+      u32 unroll_factor = 0;
+
+      Token *next = parser_peek_token(parser, 0);
+      if (token->id == TT_WHILE && next && next->id == TT_UNROLL) {
+        parser_next_token(parser);
+        Token *factor_token = parser_expect_token(parser, MASK(TT_NUMBER));
+        IrArgValue factor = token_to_number_ir_arg_value(factor_token);
+
+        if (factor.type->kind != TypeKindS64 || factor.as._s64 < 1) {
+          PERROR(STR_FMT":%u:%u: ", "Unroll factor should be a positive number\n",
+                 STR_ARG(factor_token->file_path),
+                 factor_token->row + 1, factor_token->col + 1);
+          exit(1);
+        }
+
+        unroll_factor = factor.as._s64;
+      }
+
       parser_expect_token(parser, MASK(TT_COLON));
 
       ++recursion_level;
@@ -609,6 +1128,7 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
         };
       } else {
         Str begin_label_name = gen_label_name(parser->max_labels_count++);
+        Str body_label_name = gen_label_name(parser->max_labels_count++);
         new_block = (Block) { BlockKindWhile, begin_label_name, end_label_name };
         instr = (IrInstr) {
           IrInstrKindWhile, {
@@ -618,6 +1138,8 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
               rel_op,
               begin_label_name,
               end_label_name,
+              body_label_name,
+              unroll_factor,
             },
           },
         };
@@ -687,6 +1209,8 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
       Block *last_block = parser->blocks.items + --parser->blocks.len;
       if (last_block->kind != BlockKindProc) {
         if (last_block->kind == BlockKindWhile) {
+          // Back edge, the code generator turns it into a conditional
+          // jump to the top of the loop body
           Str label_name = last_block->begin_label_name;
           IrInstr instr = { IrInstrKindJump, { .label = { label_name } } };
           DA_APPEND(*instrs, instr);
@@ -752,14 +1276,32 @@ static void parser_parse_proc_instrs(Parser *parser, IrInstrs *instrs) {
     case TT_REF:
     case TT_DEREF:
     case TT_OP: {
+      // `*T ptr[index + disp] = value` stores a value of type T
+      Type *type = NULL;
+      Token *next = parser_peek_token(parser, 0);
+      Token *after_next = parser_peek_token(parser, 1);
+      if (token->id == TT_DEREF && next &&
+          (next->id == TT_REF ||
+           (next->id == TT_IDENT && after_next && after_next->id == TT_IDENT)))
+        type = parser_parse_type(parser);
+
       Token *dest_token = parser_expect_token(parser, MASK(TT_IDENT));
-      parser_expect_token(parser, MASK(TT_ASSIGN));
-      IrArg arg = parser_parse_arg(parser);
 
       IrInstr instr = {
         IrInstrKindPreAssignOp,
-        { .pre_assign_op = { dest_token->lexeme, token->lexeme, arg } },
+        { .pre_assign_op = { dest_token->lexeme, token->lexeme, {0}, type, 0 } },
       };
+
+      next = parser_peek_token(parser, 0);
+      if (type && next && next->id == TT_OBRACKET) {
+        parser_next_token(parser);
+        instr.as.pre_assign_op.is_indexed = true;
+        parser_parse_index(parser, &instr.as.pre_assign_op.index,
+                           &instr.as.pre_assign_op.offset, type);
+      }
+
+      parser_expect_token(parser, MASK(TT_ASSIGN));
+      instr.as.pre_assign_op.arg = parser_parse_arg(parser);
       DA_APPEND(*instrs, instr);
     } break;
 
@@ -792,13 +1334,24 @@ static bool parser_parse_global_instr(Parser *parser, Ir *ir,
       }
 
       IrProc new_proc = parser_parse_proc_def(parser);
+
+      parser->vars.len = 0;
+      for (u32 i = 0; i < new_proc.params.len; ++i)
+        parser_set_var_type(parser, new_proc.params.items[i].name,
+                            new_proc.params.items[i].type);
+
       parser_parse_proc_instrs(parser, &new_proc.instrs);
       DA_APPEND(ir->procs, new_proc);
     } break;
 
     case TT_STATIC: {
       Token *name_token = parser_expect_token(parser, MASK(TT_IDENT));
-      parser_expect_token(parser, MASK(TT_ASSIGN));
+      Token *token = parser_expect_token(parser, MASK(TT_ASSIGN) | MASK(TT_COLON));
+      if (token->id == TT_COLON) {
+        parser_parse_static_array(parser, name_token->lexeme);
+        break;
+      }
+
       IrArg arg = parser_parse_arg(parser);
       if (arg.kind == IrArgKindVar) {
         ERROR("Only value can be assigned to a static variable\n");
@@ -809,7 +1362,12 @@ static bool parser_parse_global_instr(Parser *parser, Ir *ir,
       DA_APPEND(parser->static_vars, static_var);
     } break;
 
-    case TT_RECORD: {} break;
+    case TT_RECORD: {
+      // Records were collected before parsing
+      Token *token = parser_next_token(parser);
+      while (token && token->id != TT_END)
+        token = parser_next_token(parser);
+    } break;
 
     case TT_INCLUDE: {
       parser_expect_token(parser, MASK(TT_STR_LIT));
@@ -839,27 +1397,140 @@ static Ir parser_parse(Parser *parser) {
   return ir;
 }
 
+static void parser_push_static_data(Parser *parser, Ir *ir) {
+  ParserStaticData *data = &parser->static_data;
+
+  // Arrays go first, so that they keep their alignment
+  for (u32 i = 0; i < data->len; ++i) {
+    ParserStaticBuffer *buffer = data->items + i;
+
+    if (!buffer->is_str_lit) {
+      StaticBuffer static_buffer = { buffer->name, buffer->data, buffer->size };
+      DA_APPEND(ir->static_data, static_buffer);
+    }
+  }
+
+  for (u32 i = 0; i < data->len; ++i) {
+    ParserStaticBuffer *buffer = data->items + i;
+
+    if (buffer->is_str_lit) {
+      StaticBuffer static_buffer = { buffer->name, buffer->data, buffer->size };
+      DA_APPEND(ir->static_data, static_buffer);
+    }
+  }
+}
+
+static bool ir_naked_proc_uses_var(Ir *ir, Str name) {
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+    if (!proc->is_naked)
+      continue;
+
+    for (u32 j = 0; j < proc->instrs.len; ++j)
+      if (ir_instr_uses_var(proc->instrs.items + j, name))
+        return true;
+  }
+
+  return false;
+}
+
+// Every use of the literal `name` gets `tmp = base + offset` right before
+// it and reads `tmp` instead
+static void ir_point_into_buffer(Ir *ir, Str name, Str base, i64 offset,
+                                 u32 *pointers_count) {
+  for (u32 i = 0; i < ir->procs.len; ++i) {
+    IrProc *proc = ir->procs.items + i;
+    IrInstrs new_instrs = {0};
+
+    for (u32 j = 0; j < proc->instrs.len; ++j) {
+      IrInstr instr = proc->instrs.items[j];
+
+      if (ir_instr_uses_var(&instr, name)) {
+        StringBuilder sb = {0};
+        sb_push(&sb, "?sfx");
+        sb_push_u32(&sb, (*pointers_count)++);
+        Str tmp = sb_to_str(sb);
+
+        IrArg base_arg = { IrArgKindVar, { .var = base } };
+        IrInstr assign = { IrInstrKindAssign, { .assign = { tmp, base_arg } } };
+        DA_APPEND(new_instrs, assign);
+
+        IrArg tmp_arg = { IrArgKindVar, { .var = tmp } };
+        IrInstr add = {
+          IrInstrKindBinOp,
+          { .bin_op = { tmp, STR_LIT("+"), tmp_arg, ir_arg_new_s64(offset) } },
+        };
+        DA_APPEND(new_instrs, add);
+
+        ir_instr_rename_var(&instr, name, tmp);
+      }
+
+      DA_APPEND(new_instrs, instr);
+    }
+
+    proc->instrs = new_instrs;
+  }
+}
+
+// A literal that is a suffix of a longer one is not emitted, its uses
+// point into the tail of the longest literal that ends with it. Naked
+// procedures can not compute the pointer, so literals they use are kept
+static void parser_share_str_lit_suffixes(Parser *parser, Ir *ir) {
+  ParserStaticData *data = &parser->static_data;
+  bool *is_shared = calloc(data->len, sizeof(bool));
+  u32 pointers_count = 0;
+
+  for (u32 i = 0; i < data->len; ++i) {
+    ParserStaticBuffer *buffer = data->items + i;
+    if (!buffer->is_str_lit)
+      continue;
+
+    ParserStaticBuffer *longest = NULL;
+    for (u32 j = 0; j < data->len; ++j) {
+      ParserStaticBuffer *other = data->items + j;
+
+      if (other->is_str_lit && other->size > buffer->size &&
+          (!longest || other->size > longest->size) &&
+          memcmp(other->data + other->size - buffer->size,
+                 buffer->data, buffer->size) == 0)
+        longest = other;
+    }
+
+    if (!longest || ir_naked_proc_uses_var(ir, buffer->name))
+      continue;
+
+    ir_point_into_buffer(ir, buffer->name, longest->name,
+                         longest->size - buffer->size, &pointers_count);
+    is_shared[i] = true;
+  }
+
+  u32 len = 0;
+  for (u32 i = 0; i < data->len; ++i)
+    if (!is_shared[i])
+      data->items[len++] = data->items[i];
+  data->len = len;
+
+  free(is_shared);
+}
+
 Ir parse(Tokens *tokens) {
   Parser parser = {0};
   parser.tokens = tokens;
 
+  parser_collect_records(&parser);
+  parser_collect_record_procs(&parser);
+
   Ir ir = parser_parse(&parser);
 
   for (u32 i = 0; i < parser.static_vars.len; ++i) {
     Str name = parser.static_vars.items[i].name;
     IrArgValue value = parser.static_vars.items[i].value;
-    StaticVariable var = { name, ir_arg_value_to_value(&value) };
+    StaticVariable var = { name, value };
     DA_APPEND(ir.static_vars, var);
   }
 
-  for (u32 i = 0; i < parser.static_data.len; ++i) {
-    StaticBuffer buffer = {
-      parser.static_data.items[i].name,
-      parser.static_data.items[i].data,
-      parser.static_data.items[i].size,
-    };
-    DA_APPEND(ir.static_data, buffer);
-  }
+  parser_share_str_lit_suffixes(&parser, &ir);
+  parser_push_static_data(&parser, &ir);
 
   return ir;
 }